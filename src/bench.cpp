@@ -0,0 +1,257 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Timings run by 'make bench': every kernel, at each instruction set
+// level this cpu supports, on one 1920x1080 picture on one core.
+// The block ssim sums are also timed with the generic loop the
+// analyzer uses for the sizes without a kernel, which is what the
+// 4, 8 and 16 specializations replace. Times are the best of a few
+// runs, in ms per picture
+
+#include "kernels.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+
+namespace {
+	const int	W = 1920,
+			H = 1080,
+			RUNS = 5,
+			REPS = 10;
+
+	double now(void) {
+		timeval	tv;
+		gettimeofday(&tv, 0);
+		return tv.tv_sec + tv.tv_usec*1e-6;
+	}
+
+	// the results go here, so that the calls aren't optimized away
+	volatile unsigned long long	sink = 0;
+
+	// a picture: the reference, the compressed one close to it
+	struct pictures {
+		std::vector<unsigned char>	ref,
+						cmp,
+						rgb;
+		std::vector<unsigned short>	ref16,
+						cmp16;
+		std::vector<float>		f_x,
+						f_y;
+
+		pictures() : ref(W*H), cmp(W*H), rgb(3*W*H), ref16(W*H), cmp16(W*H), f_x(W*H), f_y(W*H) {
+			for(int i = 0; i < W*H; ++i) {
+				ref[i] = rand()%256;
+				cmp[i] = std::min(255, std::max(0, ref[i] + rand()%9 - 4));
+				ref16[i] = rand()%1024;
+				cmp16[i] = std::min(1023, std::max(0, ref16[i] + rand()%33 - 16));
+				f_x[i] = ref[i];
+			}
+			for(int i = 0; i < 3*W*H; ++i)
+				rgb[i] = rand()%256;
+		}
+	};
+
+	// the generic loop of the analyzer (stats.cpp, ssim_sums)
+	template<typename T, typename S>
+	void ssim_sums_loop(const T *ref, const int& ref_ls, const T *cmp, const int& cmp_ls, const unsigned int& b_sz, const unsigned int& n, S sums[][5]) {
+		for(unsigned int b = 0; b < n; ++b, ref += b_sz, cmp += b_sz) {
+			S	s[5] = { 0, 0, 0, 0, 0 };
+			for(unsigned int j = 0; j < b_sz; ++j)
+				for(unsigned int i = 0; i < b_sz; ++i) {
+					const unsigned int	c_ref = ref[j*ref_ls + i],
+								c_cmp = cmp[j*cmp_ls + i];
+					s[0] += c_ref;
+					s[1] += c_cmp;
+					s[2] += c_ref*c_ref;
+					s[3] += c_cmp*c_cmp;
+					s[4] += c_ref*c_cmp;
+				}
+			for(int k = 0; k < 5; ++k)
+				sums[b][k] = s[k];
+		}
+	}
+
+	// one picture's worth of a kernel
+	class job {
+	public:
+		virtual void run(pictures& p) = 0;
+
+		virtual ~job() {
+		}
+	};
+
+	void bench(const char* what, job& j, pictures& p) {
+		double	best = 1e9;
+		j.run(p);
+		for(int r = 0; r < RUNS; ++r) {
+			const double	t0 = now();
+			for(int i = 0; i < REPS; ++i)
+				j.run(p);
+			best = std::min(best, (now() - t0)/REPS);
+		}
+		printf("%-6s %-22s %8.3f ms\n", kernels::isa(), what, best*1e3);
+	}
+
+	struct sse_job : public job {
+		virtual void run(pictures& p) {
+			sink += kernels::sse(&p.ref[0], W, &p.cmp[0], W, W, H);
+		}
+	};
+
+	struct sse16_job : public job {
+		virtual void run(pictures& p) {
+			sink += kernels::sse16(&p.ref16[0], W, &p.cmp16[0], W, W, H);
+		}
+	};
+
+	struct ssim_4x4x2_job : public job {
+		virtual void run(pictures& p) {
+			int	sums[2][4];
+			for(int j = 0; j + 4 <= H; j += 4)
+				for(int i = 0; i + 8 <= W; i += 8) {
+					kernels::ssim_4x4x2(&p.ref[j*W + i], W, &p.cmp[j*W + i], W, sums);
+					sink += sums[1][3];
+				}
+		}
+	};
+
+	// a row of blocks per call, as compute_ssim does
+	template<typename T, typename S>
+	struct ssim_sums_job : public job {
+		typedef void (*sums_fn)(const T*, const int&, const T*, const int&, const unsigned int&, S[][5]);
+
+		const unsigned int	b_sz;
+		sums_fn			fn;
+
+		ssim_sums_job(const unsigned int& b, sums_fn f) : b_sz(b), fn(f) {
+		}
+
+		const T* ref(pictures& p);
+		const T* cmp(pictures& p);
+
+		virtual void run(pictures& p) {
+			const unsigned int	n = W/b_sz;
+			std::vector<S>		v_sums(5*n);
+			S			(*sums)[5] = reinterpret_cast<S (*)[5]>(&v_sums[0]);
+			for(unsigned int y = 0; y + b_sz <= (unsigned int)H; y += b_sz) {
+				if (fn) fn(ref(p) + y*W, W, cmp(p) + y*W, W, n, sums);
+				else ssim_sums_loop(ref(p) + y*W, W, cmp(p) + y*W, W, b_sz, n, sums);
+				sink += sums[n-1][4];
+			}
+		}
+	};
+
+	template<>
+	const unsigned char* ssim_sums_job<unsigned char, unsigned int>::ref(pictures& p) {
+		return &p.ref[0];
+	}
+
+	template<>
+	const unsigned char* ssim_sums_job<unsigned char, unsigned int>::cmp(pictures& p) {
+		return &p.cmp[0];
+	}
+
+	template<>
+	const unsigned short* ssim_sums_job<unsigned short, unsigned long long>::ref(pictures& p) {
+		return &p.ref16[0];
+	}
+
+	template<>
+	const unsigned short* ssim_sums_job<unsigned short, unsigned long long>::cmp(pictures& p) {
+		return &p.cmp16[0];
+	}
+
+	typedef ssim_sums_job<unsigned char, unsigned int>		sums8_job;
+	typedef ssim_sums_job<unsigned short, unsigned long long>	sums16_job;
+
+	struct saxpy_job : public job {
+		virtual void run(pictures& p) {
+			kernels::saxpy(&p.f_y[0], &p.f_x[0], 0.25f, W*H);
+		}
+	};
+
+	struct fdct8x8_job : public job {
+		virtual void run(pictures& p) {
+			float	out[64];
+			for(int j = 0; j + 8 <= H; j += 8)
+				for(int i = 0; i + 8 <= W; i += 8) {
+					kernels::fdct8x8(&p.ref[j*W + i], W, out);
+					sink += (unsigned long long)out[0];
+				}
+		}
+	};
+
+	struct rgb_2_hsi_job : public job {
+		std::vector<unsigned char>	hsi;
+
+		rgb_2_hsi_job() : hsi(3*W*H) {
+		}
+
+		virtual void run(pictures& p) {
+			kernels::rgb_2_hsi(&p.rgb[0], &hsi[0], 3*W*H);
+			sink += hsi[0];
+		}
+	};
+}
+
+int main(void) {
+	srand(1);
+	pictures	p;
+	kernels::get_hsi_tables();
+	printf("%dx%d, ms per picture (best of %d runs of %d)\n", W, H, RUNS, REPS);
+	for(int l = kernels::ISA_C; l <= kernels::max_isa(); ++l) {
+		kernels::set_isa((kernels::isa_level)l);
+		sse_job		sse;
+		sse16_job	sse16;
+		ssim_4x4x2_job	ssim_4x4x2;
+		sums8_job	loop_4(4, 0),
+				loop_8(8, 0),
+				loop_16(16, 0),
+				sums_4(4, kernels::ssim_sums_4),
+				sums_8(8, kernels::ssim_sums_8),
+				sums_16(16, kernels::ssim_sums_16);
+		sums16_job	sums16_4(4, kernels::ssim_sums16_4),
+				sums16_8(8, kernels::ssim_sums16_8),
+				sums16_16(16, kernels::ssim_sums16_16);
+		saxpy_job	saxpy;
+		fdct8x8_job	fdct8x8;
+		rgb_2_hsi_job	rgb_2_hsi;
+		bench("sse", sse, p);
+		bench("sse16", sse16, p);
+		bench("ssim_4x4x2", ssim_4x4x2, p);
+		// the loops don't depend on the level
+		if (kernels::ISA_C == l) {
+			bench("ssim_sums loop 4", loop_4, p);
+			bench("ssim_sums loop 8", loop_8, p);
+			bench("ssim_sums loop 16", loop_16, p);
+		}
+		bench("ssim_sums_4", sums_4, p);
+		bench("ssim_sums_8", sums_8, p);
+		bench("ssim_sums_16", sums_16, p);
+		bench("ssim_sums16_4", sums16_4, p);
+		bench("ssim_sums16_8", sums16_8, p);
+		bench("ssim_sums16_16", sums16_16, p);
+		bench("saxpy", saxpy, p);
+		bench("fdct8x8", fdct8x8, p);
+		bench("rgb_2_hsi", rgb_2_hsi, p);
+	}
+	return 0;
+}
@@ -0,0 +1,470 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Self checks run by 'make check': every kernel, as bound at each
+// instruction set level this cpu supports, against its C version on
+// random planes of odd sizes, the block ssim sums against plain loops,
+// and the rgb to hsi conversion against the per pixel formula on all
+// the 2^24 colors. Kernels promise results identical to the C ones, so
+// everything is compared exactly. Then the task pool: parallel_for has
+// to cover its range once, nested or not, and exceptions of the tasks
+// have to come out of wait
+
+#include "kernels.h"
+#include "mt.h"
+#include "shared_ptr.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+	int	n_checks = 0,
+		n_failed = 0;
+
+	void check(const bool& ok, const char* what, const int& w, const int& h) {
+		++n_checks;
+		if (ok) return;
+		if (++n_failed <= 32)
+			fprintf(stderr, "[%s] %s differs from C on %dx%d\n", kernels::isa(), what, w, h);
+	}
+
+	// odd sizes, so that every vector loop has a tail
+	const int	widths[] = { 1, 3, 7, 15, 17, 31, 33, 63, 65, 129, 723 },
+			heights[] = { 1, 3, 9, 17, 45 };
+	const int	n_widths = sizeof(widths)/sizeof(widths[0]),
+			n_heights = sizeof(heights)/sizeof(heights[0]);
+
+	// w x h samples in [0, max] with a padded linesize and the first
+	// one at a random (unaligned) offset
+	template<typename T>
+	class plane {
+		std::vector<T>	_buf;
+		int		_off;
+	public:
+		const int	w,
+				h,
+				ls;
+
+		plane(const int& _w, const int& _h, const int& max) : _off(rand()%16), w(_w), h(_h), ls(_w + rand()%32) {
+			_buf.resize(_off + ls*h + 32);
+			for(size_t i = 0; i < _buf.size(); ++i)
+				_buf[i] = rand()%(max + 1);
+		}
+
+		T* data(void) {
+			return &_buf[_off];
+		}
+
+		void fill(const T& v) {
+			std::fill(_buf.begin(), _buf.end(), v);
+		}
+	};
+
+	void check_sse(void) {
+		for(int i = 0; i < n_widths; ++i)
+			for(int j = 0; j < n_heights; ++j) {
+				plane<unsigned char>	ref(widths[i], heights[j], 255),
+							cmp(widths[i], heights[j], 255);
+				check(kernels::sse(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == kernels::sse_c(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h), "sse", ref.w, ref.h);
+				// the largest errors, for the accumulators
+				ref.fill(0);
+				cmp.fill(255);
+				check(kernels::sse(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == kernels::sse_c(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h), "sse (0 vs 255)", ref.w, ref.h);
+			}
+		for(int i = 0; i < n_widths; ++i)
+			for(int j = 0; j < n_heights; ++j) {
+				plane<unsigned short>	ref(widths[i], heights[j], 4095),
+							cmp(widths[i], heights[j], 4095);
+				check(kernels::sse16(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == kernels::sse16_c(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h), "sse16", ref.w, ref.h);
+				ref.fill(0);
+				cmp.fill(4095);
+				check(kernels::sse16(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == kernels::sse16_c(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h), "sse16 (0 vs 4095)", ref.w, ref.h);
+			}
+	}
+
+	// rows wider than a 32 bit accumulator can take: 0 against 255
+	// makes the exact sum known, C included
+	void check_sse_wide(void) {
+		plane<unsigned char>	ref(600001, 2, 255),
+					cmp(600001, 2, 255);
+		check(kernels::sse(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == kernels::sse_c(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h), "sse (wide rows)", ref.w, ref.h);
+		ref.fill(0);
+		cmp.fill(255);
+		const unsigned long long	exact = 65025ULL*ref.w*ref.h;
+		check(kernels::sse_c(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == exact, "sse_c (wide rows, 0 vs 255)", ref.w, ref.h);
+		check(kernels::sse(ref.data(), ref.ls, cmp.data(), cmp.ls, ref.w, ref.h) == exact, "sse (wide rows, 0 vs 255)", ref.w, ref.h);
+	}
+
+	// the 16 bit kernels only get samples up to 12 bits, larger ones
+	// have to be caught before
+	void check_above_depth16(void) {
+		for(int depth = 10; depth <= 12; depth += 2)
+			for(int i = 0; i < n_widths; ++i)
+				for(int j = 0; j < n_heights; ++j) {
+					plane<unsigned short>	p(widths[i], heights[j], (1 << depth) - 1);
+					check(!kernels::above_depth16(p.data(), p.ls, p.w, p.h, depth), "above_depth16 (in range)", p.w, p.h);
+					p.data()[(rand()%p.h)*p.ls + rand()%p.w] = 1 << depth;
+					check(kernels::above_depth16(p.data(), p.ls, p.w, p.h, depth), "above_depth16 (out of range)", p.w, p.h);
+				}
+	}
+
+	// blocks of random size and position in a large plane, as the
+	// psnr bands are
+	void check_sse_blocks(void) {
+		plane<unsigned char>	ref(1923, 1081, 255),
+					cmp(1923, 1081, 255);
+		for(int k = 0; k < 1000; ++k) {
+			const int	w = 1 + rand()%ref.w,
+					h = 1 + rand()%64,
+					x = rand()%(ref.w - w + 1),
+					y = rand()%(ref.h - h + 1);
+			const unsigned char	*r = ref.data() + y*ref.ls + x,
+						*c = cmp.data() + y*cmp.ls + x;
+			check(kernels::sse(r, ref.ls, c, cmp.ls, w, h) == kernels::sse_c(r, ref.ls, c, cmp.ls, w, h), "sse (random block)", w, h);
+		}
+	}
+
+	void check_ssim_4x4x2(void) {
+		for(int i = 0; i < n_widths; ++i)
+			for(int j = 0; j < n_heights; ++j) {
+				if (widths[i] < 8 || heights[j] < 4) continue;
+				plane<unsigned char>	ref(widths[i], heights[j], 255),
+							cmp(widths[i], heights[j], 255);
+				for(int y = 0; y + 4 <= ref.h; y += 4)
+					for(int x = 0; x + 8 <= ref.w; x += 4) {
+						int	s[2][4],
+							s_c[2][4];
+						kernels::ssim_4x4x2(ref.data() + y*ref.ls + x, ref.ls, cmp.data() + y*cmp.ls + x, cmp.ls, s);
+						kernels::ssim_4x4x2_c(ref.data() + y*ref.ls + x, ref.ls, cmp.data() + y*cmp.ls + x, cmp.ls, s_c);
+						check(0 == memcmp(s, s_c, sizeof(s)), "ssim_4x4x2", ref.w, ref.h);
+					}
+			}
+	}
+
+	// sums of the n B x B blocks of a row, as plain loops
+	template<unsigned int B, typename T, typename S>
+	void ssim_sums_plain(const T *ref, const int& ref_ls, const T *cmp, const int& cmp_ls, const unsigned int& n, S sums[][5]) {
+		for(unsigned int b = 0; b < n; ++b) {
+			for(int k = 0; k < 5; ++k)
+				sums[b][k] = 0;
+			for(unsigned int j = 0; j < B; ++j)
+				for(unsigned int i = 0; i < B; ++i) {
+					const S	r = ref[j*ref_ls + b*B + i],
+						c = cmp[j*cmp_ls + b*B + i];
+					sums[b][0] += r;
+					sums[b][1] += c;
+					sums[b][2] += r*r;
+					sums[b][3] += c*c;
+					sums[b][4] += r*c;
+				}
+		}
+	}
+
+	// the per block size kernels: C against plain loops, the bound
+	// one against C
+	template<unsigned int B>
+	void check_ssim_sums(const kernels::ssim_sums_fn& fn, const kernels::ssim_sums16_fn& fn16, const char* name, const char* name16) {
+		for(int i = 0; i < n_widths; ++i)
+			for(int j = 0; j < n_heights; ++j) {
+				const unsigned int	n = widths[i]/B;
+				if (!n || heights[j] < (int)B) continue;
+				std::vector<unsigned int>	v(3*5*n);
+				unsigned int			(*s)[5] = (unsigned int (*)[5])&v[0],
+								(*s_c)[5] = s + n,
+								(*s_p)[5] = s + 2*n;
+				plane<unsigned char>		ref(widths[i], heights[j], 255),
+								cmp(widths[i], heights[j], 255);
+				std::vector<unsigned long long>	v16(3*5*n);
+				unsigned long long		(*s16)[5] = (unsigned long long (*)[5])&v16[0],
+								(*s16_c)[5] = s16 + n,
+								(*s16_p)[5] = s16 + 2*n;
+				plane<unsigned short>		ref16(widths[i], heights[j], 4095),
+								cmp16(widths[i], heights[j], 4095);
+				for(int y = 0; y + (int)B <= ref.h; ++y) {
+					fn(ref.data() + y*ref.ls, ref.ls, cmp.data() + y*cmp.ls, cmp.ls, n, s);
+					kernels::ssim_sums_c<B>(ref.data() + y*ref.ls, ref.ls, cmp.data() + y*cmp.ls, cmp.ls, n, s_c);
+					ssim_sums_plain<B>(ref.data() + y*ref.ls, ref.ls, cmp.data() + y*cmp.ls, cmp.ls, n, s_p);
+					check(0 == memcmp(s, s_c, 5*n*sizeof(unsigned int)), name, ref.w, ref.h);
+					check(0 == memcmp(s_c, s_p, 5*n*sizeof(unsigned int)), "plain loops", ref.w, ref.h);
+					fn16(ref16.data() + y*ref16.ls, ref16.ls, cmp16.data() + y*cmp16.ls, cmp16.ls, n, s16);
+					kernels::ssim_sums16_c<B>(ref16.data() + y*ref16.ls, ref16.ls, cmp16.data() + y*cmp16.ls, cmp16.ls, n, s16_c);
+					ssim_sums_plain<B>(ref16.data() + y*ref16.ls, ref16.ls, cmp16.data() + y*cmp16.ls, cmp16.ls, n, s16_p);
+					check(0 == memcmp(s16, s16_c, 5*n*sizeof(unsigned long long)), name16, ref16.w, ref16.h);
+					check(0 == memcmp(s16_c, s16_p, 5*n*sizeof(unsigned long long)), "plain loops (16 bits)", ref16.w, ref16.h);
+				}
+			}
+	}
+
+	void check_saxpy(void) {
+		for(int i = 0; i < n_widths; ++i) {
+			const unsigned int	n = widths[i];
+			std::vector<float>	x(n + 1),
+						y(n + 1);
+			for(unsigned int k = 0; k <= n; ++k) {
+				x[k] = (rand() - RAND_MAX/2)/1024.0f;
+				y[k] = (rand() - RAND_MAX/2)/1024.0f;
+			}
+			const float		a = (rand() - RAND_MAX/2)/(float)RAND_MAX;
+			std::vector<float>	y_c(y);
+			// one float off, to have unaligned vectors too
+			kernels::saxpy(&y[1], &x[1], a, n);
+			kernels::saxpy_c(&y_c[1], &x[1], a, n);
+			check(0 == memcmp(&y[0], &y_c[0], (n + 1)*sizeof(float)), "saxpy", n, 1);
+		}
+	}
+
+	void check_fdct8x8(void) {
+		for(int i = 0; i < n_widths; ++i)
+			for(int j = 0; j < n_heights; ++j) {
+				if (widths[i] < 8 || heights[j] < 8) continue;
+				plane<unsigned char>	src(widths[i], heights[j], 255);
+				for(int y = 0; y + 8 <= src.h; y += 8)
+					for(int x = 0; x + 8 <= src.w; x += 8) {
+						float	out[64],
+							out_c[64];
+						kernels::fdct8x8(src.data() + y*src.ls + x, src.ls, out);
+						kernels::fdct8x8_c(src.data() + y*src.ls + x, src.ls, out_c);
+						check(0 == memcmp(out, out_c, sizeof(out)), "fdct8x8", src.w, src.h);
+					}
+			}
+	}
+
+	// the conversion psnr had before the tables
+	void rgb_2_hsi_formula(const unsigned char *src, unsigned char *dst, const int& sz) {
+		const static double PI = 3.14159265;
+		for(int j = 0; j < sz; j += 3) {
+			const int	r = src[j+0],
+					g = src[j+1],
+					b = src[j+2],
+					sum = r + g + b,
+					den_2 = (r-g)*(r-g) + (r-b)*(g-b);
+			if (den_2) {
+				const double	c = 0.5*(r-g + r-b) / sqrt((double)den_2),
+						h = std::max(0.0, std::min(1.0, acos(std::max(-1.0, std::min(1.0, c)))/PI));
+				dst[j+0] = 255.0*h + 0.5;
+			} else dst[j+0] = 255;
+			dst[j+1] = sum ? (511*sum - 1530*std::min(r, std::min(g, b)))/(2*sum) : 255;
+			dst[j+2] = (sum + 1)/3;
+		}
+	}
+
+	void check_hsi(void) {
+		unsigned char	rgb[256*3],
+				hsi[256*3],
+				hsi_f[256*3];
+		for(int r = 0; r < 256; ++r)
+			for(int g = 0; g < 256; ++g) {
+				for(int b = 0; b < 256; ++b) {
+					rgb[3*b+0] = r;
+					rgb[3*b+1] = g;
+					rgb[3*b+2] = b;
+				}
+				kernels::rgb_2_hsi(rgb, hsi, sizeof(rgb));
+				rgb_2_hsi_formula(rgb, hsi_f, sizeof(rgb));
+				++n_checks;
+				if (0 != memcmp(hsi, hsi_f, sizeof(hsi)) && ++n_failed <= 32)
+					fprintf(stderr, "[%s] rgb_2_hsi differs from the formula for r=%d g=%d\n", kernels::isa(), r, g);
+			}
+	}
+
+	void check_pool(const bool& ok, const char* what, const size_t& n, const size_t& grain) {
+		++n_checks;
+		if (ok) return;
+		if (++n_failed <= 32)
+			fprintf(stderr, "[pool] %s failed on %u items, grain %u\n", what, (unsigned int)n, (unsigned int)grain);
+	}
+
+	// counts the visits of each index, throws on thrw if set
+	struct count_body {
+		std::vector<int>	&hits;
+		const size_t		thrw;
+
+		count_body(std::vector<int>& h, const size_t& t = (size_t)-1) : hits(h), thrw(t) {
+		}
+
+		void operator()(const size_t& b, const size_t& e) {
+			for(size_t i = b; i < e; ++i) {
+				__sync_add_and_fetch(&hits[i], 1);
+				if (i == thrw) throw std::runtime_error("count_body");
+			}
+		}
+	};
+
+	bool once(const std::vector<int>& hits) {
+		for(size_t i = 0; i < hits.size(); ++i)
+			if (1 != hits[i]) return false;
+		return true;
+	}
+
+	// a parallel_for of its own from inside a worker
+	class nested_task : public mt::Task {
+		mt::TaskPool		&_pool;
+		std::vector<int>	&_hits;
+	public:
+		nested_task(mt::TaskPool& pool, std::vector<int>& hits) : _pool(pool), _hits(hits) {
+		}
+
+		virtual void run(void) {
+			count_body	body(_hits);
+			mt::parallel_for(_pool, 0, _hits.size(), 7, body);
+		}
+	};
+
+	class throw_task : public mt::Task {
+		bool	&_ran;
+	public:
+		throw_task(bool& ran) : _ran(ran) {
+		}
+
+		virtual void run(void) {
+			_ran = true;
+			throw std::runtime_error("throw_task");
+		}
+	};
+
+	// a single task and its own latch, the way the scaler uses the pool
+	class latch_task : public mt::Task {
+		volatile int	&_n;
+		mt::Latch	_done;
+	public:
+		latch_task(volatile int& n) : _n(n), _done(1) {
+		}
+
+		virtual void run(void) {
+			__sync_add_and_fetch(&_n, 1);
+			_done.count_down();
+		}
+
+		mt::Latch& done(void) {
+			return _done;
+		}
+	};
+
+	void check_task_pool(void) {
+		// pools going up and down, busy or idle
+		for(unsigned int n = 1; n <= 8; ++n) {
+			volatile int	runs = 0;
+			{
+				mt::TaskPool	pool(n);
+				for(int i = 0; i < 64; ++i) {
+					latch_task	*t = new latch_task(runs);
+					pool.spawn(t);
+					pool.wait(t->done());
+					delete t;
+				}
+			}
+			check_pool(64 == runs, "spawn and wait", 64, n);
+		}
+		mt::TaskPool	pool(4);
+		const size_t	sizes[] = { 1, 2, 3, 17, 1000, 100003 },
+				grains[] = { 1, 2, 7, 64, 1000000 };
+		for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+			for(size_t g = 0; g < sizeof(grains)/sizeof(grains[0]); ++g) {
+				const size_t		n = sizes[i];
+				std::vector<int>	hits(n);
+				count_body		body(hits);
+				mt::parallel_for(pool, 0, n, grains[g], body);
+				check_pool(once(hits), "parallel_for", n, grains[g]);
+				// one index throws, all the others still run
+				// and the exception comes out
+				std::vector<int>	t_hits(n);
+				count_body		t_body(t_hits, n/2);
+				bool			thrown = false;
+				try {
+					mt::parallel_for(pool, 0, n, grains[g], t_body);
+				} catch(std::exception& e) {
+					thrown = (0 == strcmp(e.what(), "count_body"));
+				}
+				check_pool(thrown, "parallel_for exception", n, grains[g]);
+				int	n_hits = 0;
+				for(size_t j = 0; j < n; ++j)
+					n_hits += t_hits[j];
+				// a range stops at its throw
+				check_pool(t_hits[n/2] == 1 && n_hits >= (int)(n/2 + 1) && n_hits <= (int)n, "parallel_for after exception", n, grains[g]);
+			}
+		// groups of tasks doing their own parallel_for, one of them
+		// throwing
+		std::vector<std::vector<int> >	v_hits(16, std::vector<int>(5001));
+		std::vector<shared_ptr<nested_task> > v_tasks;
+		bool				ran = false;
+		throw_task			t_task(ran);
+		mt::TaskGroup			tg(pool);
+		for(size_t i = 0; i < v_hits.size(); ++i) {
+			v_tasks.push_back(new nested_task(pool, v_hits[i]));
+			tg.add(v_tasks.rbegin()->get());
+		}
+		tg.add(&t_task);
+		bool	thrown = false;
+		try {
+			tg.wait();
+		} catch(std::exception& e) {
+			thrown = (0 == strcmp(e.what(), "throw_task"));
+		}
+		check_pool(ran && thrown, "TaskGroup exception", v_hits.size() + 1, 1);
+		bool	all = true;
+		for(size_t i = 0; i < v_hits.size(); ++i)
+			all = all && once(v_hits[i]);
+		check_pool(all, "TaskGroup nested parallel_for", v_hits.size() + 1, 1);
+		// the group is empty and usable again after the throw
+		for(size_t i = 0; i < v_hits.size(); ++i) {
+			std::fill(v_hits[i].begin(), v_hits[i].end(), 0);
+			tg.add(v_tasks[i].get());
+		}
+		thrown = false;
+		try {
+			tg.wait();
+		} catch(...) {
+			thrown = true;
+		}
+		all = !thrown;
+		for(size_t i = 0; i < v_hits.size(); ++i)
+			all = all && once(v_hits[i]);
+		check_pool(all, "TaskGroup reuse", v_hits.size(), 1);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+	for(int l = kernels::ISA_C; l <= kernels::max_isa(); ++l) {
+		kernels::set_isa((kernels::isa_level)l);
+		const int	n_prev = n_failed;
+		check_sse();
+		check_sse_wide();
+		check_above_depth16();
+		check_sse_blocks();
+		check_ssim_4x4x2();
+		check_ssim_sums<4>(kernels::ssim_sums_4, kernels::ssim_sums16_4, "ssim_sums_4", "ssim_sums16_4");
+		check_ssim_sums<8>(kernels::ssim_sums_8, kernels::ssim_sums16_8, "ssim_sums_8", "ssim_sums16_8");
+		check_ssim_sums<16>(kernels::ssim_sums_16, kernels::ssim_sums16_16, "ssim_sums_16", "ssim_sums16_16");
+		check_saxpy();
+		check_fdct8x8();
+		check_hsi();
+		printf("%s kernels: %s\n", kernels::isa(), (n_prev == n_failed) ? "ok" : "FAILED");
+	}
+	const int	n_prev = n_failed;
+	check_task_pool();
+	printf("task pool: %s\n", (n_prev == n_failed) ? "ok" : "FAILED");
+	printf("%d checks, %d failed\n", n_checks, n_failed);
+	return n_failed ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <algorithm>
+#include "frame_pool.h"
+
+namespace qav {
+	// pixel layouts an analyzer can ask for
+	enum pix_layout {
+		PL_RGB24 = 0,	// packed R G B, 3 bytes per pixel
+		PL_YUV420P,	// planar Y Cb Cr, chroma subsampled 2x2
+		PL_YUV420P10,	// as PL_YUV420P, 10 bits in 16 bit (native endian) samples
+		PL_YUV420P12	// as PL_YUV420P, 12 bits in 16 bit (native endian) samples
+	};
+
+	// bits per sample of a layout
+	inline int layout_depth(const pix_layout& layout) {
+		switch(layout) {
+			case PL_YUV420P10:
+				return 10;
+			case PL_YUV420P12:
+				return 12;
+			default:
+				break;
+		}
+		return 8;
+	}
+
+	inline const char *layout_name(const pix_layout& layout) {
+		switch(layout) {
+			case PL_RGB24:
+				return "rgb24";
+			case PL_YUV420P10:
+				return "yuv420p10";
+			case PL_YUV420P12:
+				return "yuv420p12";
+			default:
+				break;
+		}
+		return "yuv420p";
+	}
+
+	// A decoded picture. Planes either live in the frame own
+	// buffer or are borrowed from someone else (ie. the decoder),
+	// in which case the release function is called once the frame
+	// is done with them.
+	// Own buffers come from the frame_pool: rows are aligned on
+	// frame_pool::ALIGN bytes and the buffer is kept across alloc
+	// calls as long as it's big enough
+	class frame {
+		pix_layout			_layout;
+		int				_width,
+						_height;
+		long long			_pts;	// microseconds from the stream start
+		unsigned char			*_data[3];
+		int				_linesize[3];
+		unsigned char			*_buf;
+		size_t				_buf_cap;
+		void				*_ref;
+		void				(*_ref_free)(void*);
+
+		void unref(void) {
+			if (_ref && _ref_free) _ref_free(_ref);
+			_ref = 0;
+			_ref_free = 0;
+		}
+
+		void free_buf(void) {
+			if (_buf) frame_pool::get().checkin(_buf, _buf_cap);
+			_buf = 0;
+			_buf_cap = 0;
+		}
+
+		void setup(const pix_layout& layout, const int& width, const int& height) {
+			_layout = layout;
+			_width = width;
+			_height = height;
+			for(int i = 0; i < 3; ++i) {
+				_data[i] = 0;
+				_linesize[i] = 0;
+			}
+		}
+	public:
+		frame() : _layout(PL_RGB24), _width(0), _height(0), _pts(0), _buf(0), _buf_cap(0), _ref(0), _ref_free(0) {
+			setup(PL_RGB24, 0, 0);
+		}
+
+		// deep copy, the new frame always owns its planes
+		frame(const frame& rhs) : _layout(PL_RGB24), _width(0), _height(0), _pts(0), _buf(0), _buf_cap(0), _ref(0), _ref_free(0) {
+			setup(PL_RGB24, 0, 0);
+			copy(rhs);
+		}
+
+		frame& operator=(const frame& rhs) {
+			if (this != &rhs) copy(rhs);
+			return *this;
+		}
+
+		// bytes of an own buffer for the given layout
+		static size_t buf_size(const pix_layout& layout, const int& width, const int& height) {
+			frame	f;
+			f.setup(layout, width, height);
+			size_t	sz = 0;
+			for(int i = 0; i < f.n_planes(); ++i)
+				sz += (size_t)f.aligned_width(i)*f.plane_height(i);
+			return sz;
+		}
+
+		// get an own buffer for the given layout
+		void alloc(const pix_layout& layout, const int& width, const int& height) {
+			unref();
+			const size_t	sz = buf_size(layout, width, height);
+			setup(layout, width, height);
+			if (_buf_cap < sz + frame_pool::PADDING) {
+				free_buf();
+				_buf = frame_pool::get().checkout(sz, _buf_cap);
+			}
+			unsigned char	*p = _buf;
+			for(int i = 0; i < n_planes(); ++i) {
+				_linesize[i] = aligned_width(i);
+				_data[i] = p;
+				p += (size_t)_linesize[i]*plane_height(i);
+			}
+		}
+
+		// borrow planes owned by someone else, ref_free(ref) will
+		// be called when the frame gets released
+		void set_ref(const pix_layout& layout, const int& width, const int& height, unsigned char* const data[], const int linesize[], void *ref, void (*ref_free)(void*)) {
+			unref();
+			free_buf();
+			setup(layout, width, height);
+			for(int i = 0; i < n_planes(); ++i) {
+				_data[i] = data[i];
+				_linesize[i] = linesize[i];
+			}
+			_ref = ref;
+			_ref_free = ref_free;
+		}
+
+		void copy(const frame& rhs) {
+			alloc(rhs._layout, rhs._width, rhs._height);
+			_pts = rhs._pts;
+			for(int i = 0; i < n_planes(); ++i)
+				for(int j = 0; j < plane_height(i); ++j)
+					std::copy(rhs._data[i] + j*rhs._linesize[i], rhs._data[i] + j*rhs._linesize[i] + plane_width(i), _data[i] + j*_linesize[i]);
+		}
+
+		void swap(frame& rhs) {
+			std::swap(_layout, rhs._layout);
+			std::swap(_width, rhs._width);
+			std::swap(_height, rhs._height);
+			std::swap(_pts, rhs._pts);
+			for(int i = 0; i < 3; ++i) {
+				std::swap(_data[i], rhs._data[i]);
+				std::swap(_linesize[i], rhs._linesize[i]);
+			}
+			std::swap(_buf, rhs._buf);
+			std::swap(_buf_cap, rhs._buf_cap);
+			std::swap(_ref, rhs._ref);
+			std::swap(_ref_free, rhs._ref_free);
+		}
+
+		bool is_ref(void) const {
+			return 0 != _ref;
+		}
+
+		pix_layout layout(void) const {
+			return _layout;
+		}
+
+		int width(void) const {
+			return _width;
+		}
+
+		int height(void) const {
+			return _height;
+		}
+
+		// presentation time, used to pair the frames of the videos
+		long long pts(void) const {
+			return _pts;
+		}
+
+		void set_pts(const long long& pts) {
+			_pts = pts;
+		}
+
+		int n_planes(void) const {
+			return (PL_RGB24 == _layout) ? 1 : 3;
+		}
+
+		// significant bits of a sample
+		int depth(void) const {
+			return layout_depth(_layout);
+		}
+
+		// bytes of a sample, high bit depth layouts use 16 bits
+		int sample_bytes(void) const {
+			return (8 < depth()) ? 2 : 1;
+		}
+
+		// width of a plane row in bytes (without padding)
+		int plane_width(const int& plane) const {
+			return sample_bytes()*plane_samples(plane);
+		}
+
+		// width of a plane row in samples
+		int plane_samples(const int& plane) const {
+			if (PL_RGB24 == _layout) return 3*_width;
+			return (0 == plane) ? _width : (_width+1)/2;
+		}
+
+		// plane_width rounded up to the buffer row alignment
+		int aligned_width(const int& plane) const {
+			return (plane_width(plane) + frame_pool::ALIGN - 1) & ~(frame_pool::ALIGN - 1);
+		}
+
+		int plane_height(const int& plane) const {
+			if (PL_RGB24 == _layout) return _height;
+			return (0 == plane) ? _height : (_height+1)/2;
+		}
+
+		unsigned char *data(const int& plane) {
+			return _data[plane];
+		}
+
+		const unsigned char *data(const int& plane) const {
+			return _data[plane];
+		}
+
+		int linesize(const int& plane) const {
+			return _linesize[plane];
+		}
+
+		// C style arrays for libswscale
+		unsigned char **planes(void) {
+			return _data;
+		}
+
+		int *linesizes(void) {
+			return _linesize;
+		}
+
+		~frame() {
+			unref();
+			free_buf();
+		}
+	};
+}
+
+#endif /*_FRAME_H_*/
@@ -0,0 +1,117 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frame_pool.h"
+#include "settings.h"
+#include <stdexcept>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/mman.h>
+
+namespace {
+	const size_t	HUGE_PAGE_SZ = 2*1024*1024;
+
+	size_t huge_round(const size_t& sz) {
+		return (sz + HUGE_PAGE_SZ - 1) & ~(HUGE_PAGE_SZ - 1);
+	}
+}
+
+qav::frame_pool::frame_pool() : _buf_sz(0), _huge_pages(false), _in_use(0), _high_water(0) {
+}
+
+qav::frame_pool& qav::frame_pool::get(void) {
+	static frame_pool	pool;
+	return pool;
+}
+
+unsigned char *qav::frame_pool::allocate(const size_t& sz, const bool& huge_pages) {
+	if (huge_pages) {
+		// try explicit huge pages first, then ask for transparent ones
+		const size_t	h_sz = huge_round(sz);
+		void		*p = mmap(0, h_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (MAP_FAILED == p) {
+			p = mmap(0, h_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if (MAP_FAILED == p)
+				throw std::bad_alloc();
+			madvise(p, h_sz, MADV_HUGEPAGE);
+		}
+		return (unsigned char*)p;
+	}
+	void	*p = 0;
+	if (0 != posix_memalign(&p, ALIGN, sz))
+		throw std::bad_alloc();
+	return (unsigned char*)p;
+}
+
+void qav::frame_pool::release(unsigned char *p, const size_t& sz, const bool& huge_pages) {
+	if (huge_pages) munmap(p, huge_round(sz));
+	else free(p);
+}
+
+void qav::frame_pool::init(const size_t& buf_sz, const unsigned int& n_bufs, const bool& huge_pages) {
+	mt::ScopedLock	_sl(_mtx);
+	if (_in_use)
+		throw std::runtime_error("Frame pool can't be initialized while buffers are in use");
+	for(std::vector<unsigned char*>::iterator it = _all.begin(); it != _all.end(); ++it)
+		release(*it, _buf_sz, _huge_pages);
+	_all.clear();
+	_free.clear();
+	_buf_sz = buf_sz + PADDING;
+	_huge_pages = huge_pages;
+	_high_water = 0;
+	for(unsigned int i = 0; i < n_bufs; ++i) {
+		_all.push_back(allocate(_buf_sz, _huge_pages));
+		_free.push_back(_all.back());
+	}
+	LOG_DEBUG << "Frame pool: " << n_bufs << " buffers of " << _buf_sz << " bytes" << (_huge_pages ? " (huge pages)" : "") << std::endl;
+}
+
+unsigned char *qav::frame_pool::checkout(const size_t& sz, size_t& cap) {
+	mt::ScopedLock	_sl(_mtx);
+	if (sz + PADDING > _buf_sz) {
+		// not the size we pool, just give a one off buffer
+		cap = sz + PADDING;
+		return allocate(cap, false);
+	}
+	if (_free.empty()) {
+		_all.push_back(allocate(_buf_sz, _huge_pages));
+		_free.push_back(_all.back());
+		LOG_DEBUG << "Frame pool: grown to " << _all.size() << " buffers" << std::endl;
+	}
+	unsigned char	*p = _free.back();
+	_free.pop_back();
+	if (++_in_use > _high_water) _high_water = _in_use;
+	cap = _buf_sz;
+	return p;
+}
+
+void qav::frame_pool::checkin(unsigned char *p, const size_t& cap) {
+	mt::ScopedLock	_sl(_mtx);
+	if (std::find(_all.begin(), _all.end(), p) == _all.end()) {
+		release(p, cap, false);
+		return;
+	}
+	_free.push_back(p);
+	--_in_use;
+}
+
+qav::frame_pool::~frame_pool() {
+	for(std::vector<unsigned char*>::iterator it = _all.begin(); it != _all.end(); ++it)
+		release(*it, _buf_sz, _huge_pages);
+}
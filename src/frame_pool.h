@@ -0,0 +1,81 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FRAME_POOL_H_
+#define _FRAME_POOL_H_
+
+#include <vector>
+#include <cstddef>
+#include "mt.h"
+
+namespace qav {
+	// Frame buffers shared by all the videos. The pool hands out
+	// buffers of one size (the analysis frame size), aligned on
+	// ALIGN bytes with PADDING spare bytes at the end, so kernels
+	// can load full SIMD registers past the last pixel.
+	// Other sizes are served too, but are not kept for reuse
+	class frame_pool {
+		mt::Mutex			_mtx;
+		size_t				_buf_sz;
+		bool				_huge_pages;
+		std::vector<unsigned char*>	_free,
+						_all;
+		unsigned int			_in_use,
+						_high_water;
+
+		unsigned char *allocate(const size_t& sz, const bool& huge_pages);
+		void release(unsigned char *p, const size_t& sz, const bool& huge_pages);
+
+		frame_pool();
+		frame_pool(const frame_pool&);
+		frame_pool& operator=(const frame_pool&);
+	public:
+		static const size_t	ALIGN = 64,
+					PADDING = 64;
+
+		static frame_pool& get(void);
+
+		// preallocate n_bufs buffers of buf_sz bytes (plus PADDING),
+		// optionally backed by huge pages
+		void init(const size_t& buf_sz, const unsigned int& n_bufs, const bool& huge_pages);
+
+		// get a buffer of at least sz bytes (plus PADDING), cap is
+		// set to its real size
+		unsigned char *checkout(const size_t& sz, size_t& cap);
+
+		void checkin(unsigned char *p, const size_t& cap);
+
+		size_t buf_size(void) const {
+			return _buf_sz;
+		}
+
+		unsigned int n_bufs(void) const {
+			return _all.size();
+		}
+
+		// max number of pool buffers used at the same time
+		unsigned int high_water(void) const {
+			return _high_water;
+		}
+
+		~frame_pool();
+	};
+}
+
+#endif /*_FRAME_POOL_H_*/
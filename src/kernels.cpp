@@ -0,0 +1,603 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "kernels.h"
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+	// horizontal sum of the two 64 bit lanes
+#if defined(__SSE2__)
+	inline unsigned long long hsum_epi64(const __m128i& v) {
+		unsigned long long	l[2];
+		_mm_storeu_si128((__m128i*)l, v);
+		return l[0] + l[1];
+	}
+
+	// horizontal sum of the four 32 bit lanes
+	inline unsigned int hsum_epi32(const __m128i& v) {
+		const __m128i	s = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtsi128_si32(_mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+#endif
+
+	// cos(k*pi/16) and the orthonormal scale of the dc term
+	const float	DCT_C1 = 0.98078528040323044913f,
+			DCT_C2 = 0.92387953251128675613f,
+			DCT_C3 = 0.83146961230254523708f,
+			DCT_C4 = 0.70710678118654752440f,
+			DCT_C5 = 0.55557023301960222474f,
+			DCT_C6 = 0.38268343236508977173f,
+			DCT_C7 = 0.19509032201612826785f,
+			DCT_S0 = 0.35355339059327376220f;
+
+	// 8 point DCT-II of x[0], x[s], ... x[7*s], even/odd butterfly
+	void dct8(const float *x, const int& s, float *y, const int& y_s) {
+		const float	s07 = x[0] + x[7*s], d07 = x[0] - x[7*s],
+				s16 = x[s] + x[6*s], d16 = x[s] - x[6*s],
+				s25 = x[2*s] + x[5*s], d25 = x[2*s] - x[5*s],
+				s34 = x[3*s] + x[4*s], d34 = x[3*s] - x[4*s],
+				a0 = s07 + s34, a3 = s07 - s34,
+				a1 = s16 + s25, a2 = s16 - s25;
+		y[0] = DCT_S0*(a0 + a1);
+		y[4*y_s] = 0.5f*(DCT_C4*(a0 - a1));
+		y[2*y_s] = 0.5f*(DCT_C2*a3 + DCT_C6*a2);
+		y[6*y_s] = 0.5f*(DCT_C6*a3 - DCT_C2*a2);
+		y[y_s] = 0.5f*(DCT_C1*d07 + DCT_C3*d16 + DCT_C5*d25 + DCT_C7*d34);
+		y[3*y_s] = 0.5f*(DCT_C3*d07 - DCT_C7*d16 - DCT_C1*d25 - DCT_C5*d34);
+		y[5*y_s] = 0.5f*(DCT_C5*d07 - DCT_C1*d16 + DCT_C7*d25 + DCT_C3*d34);
+		y[7*y_s] = 0.5f*(DCT_C7*d07 - DCT_C5*d16 + DCT_C3*d25 - DCT_C1*d34);
+	}
+
+#if defined(__SSE2__)
+	// the same on 4 columns at once, in place
+	inline void dct8_ps(__m128 x[8]) {
+		const __m128	half = _mm_set1_ps(0.5f),
+				c1 = _mm_set1_ps(DCT_C1), c2 = _mm_set1_ps(DCT_C2),
+				c3 = _mm_set1_ps(DCT_C3), c4 = _mm_set1_ps(DCT_C4),
+				c5 = _mm_set1_ps(DCT_C5), c6 = _mm_set1_ps(DCT_C6),
+				c7 = _mm_set1_ps(DCT_C7), s0 = _mm_set1_ps(DCT_S0),
+				s07 = _mm_add_ps(x[0], x[7]), d07 = _mm_sub_ps(x[0], x[7]),
+				s16 = _mm_add_ps(x[1], x[6]), d16 = _mm_sub_ps(x[1], x[6]),
+				s25 = _mm_add_ps(x[2], x[5]), d25 = _mm_sub_ps(x[2], x[5]),
+				s34 = _mm_add_ps(x[3], x[4]), d34 = _mm_sub_ps(x[3], x[4]),
+				a0 = _mm_add_ps(s07, s34), a3 = _mm_sub_ps(s07, s34),
+				a1 = _mm_add_ps(s16, s25), a2 = _mm_sub_ps(s16, s25);
+		x[0] = _mm_mul_ps(s0, _mm_add_ps(a0, a1));
+		x[4] = _mm_mul_ps(half, _mm_mul_ps(c4, _mm_sub_ps(a0, a1)));
+		x[2] = _mm_mul_ps(half, _mm_add_ps(_mm_mul_ps(c2, a3), _mm_mul_ps(c6, a2)));
+		x[6] = _mm_mul_ps(half, _mm_sub_ps(_mm_mul_ps(c6, a3), _mm_mul_ps(c2, a2)));
+		x[1] = _mm_mul_ps(half, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c1, d07), _mm_mul_ps(c3, d16)), _mm_mul_ps(c5, d25)), _mm_mul_ps(c7, d34)));
+		x[3] = _mm_mul_ps(half, _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(c3, d07), _mm_mul_ps(c7, d16)), _mm_mul_ps(c1, d25)), _mm_mul_ps(c5, d34)));
+		x[5] = _mm_mul_ps(half, _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(c5, d07), _mm_mul_ps(c1, d16)), _mm_mul_ps(c7, d25)), _mm_mul_ps(c3, d34)));
+		x[7] = _mm_mul_ps(half, _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(c7, d07), _mm_mul_ps(c5, d16)), _mm_mul_ps(c3, d25)), _mm_mul_ps(c1, d34)));
+	}
+
+	// transpose the 8x8 block whose rows are lo[j] (columns 0-3)
+	// and hi[j] (columns 4-7)
+	inline void transpose8_ps(__m128 lo[8], __m128 hi[8]) {
+		_MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+		_MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+		_MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+		_MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+		for(int i = 0; i < 4; ++i) {
+			const __m128	t = hi[i];
+			hi[i] = lo[4 + i];
+			lo[4 + i] = t;
+		}
+	}
+#endif
+
+	// cpuid, through the gcc builtins
+	bool has_sse2(void) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+#else
+		return false;
+#endif
+	}
+
+	bool has_avx2(void) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+	const char	*isa_names[] = { "c", "sse2", "avx2" };
+
+	kernels::isa_level	cur_isa = kernels::ISA_C;
+
+	// version of a kernel for level: the best one up to it, a
+	// kernel may have no version for some levels (0)
+	template<typename F>
+	F pick(const kernels::isa_level& level, const F& c, const F& sse2, const F& avx2) {
+		if (level >= kernels::ISA_AVX2 && avx2) return avx2;
+		if (level >= kernels::ISA_SSE2 && sse2) return sse2;
+		return c;
+	}
+}
+
+kernels::sse_fn		kernels::sse;
+kernels::sse16_fn	kernels::sse16;
+kernels::ssim_4x4x2_fn	kernels::ssim_4x4x2;
+kernels::ssim_sums_fn	kernels::ssim_sums_4;
+kernels::ssim_sums_fn	kernels::ssim_sums_8;
+kernels::ssim_sums_fn	kernels::ssim_sums_16;
+kernels::ssim_sums16_fn	kernels::ssim_sums16_4;
+kernels::ssim_sums16_fn	kernels::ssim_sums16_8;
+kernels::ssim_sums16_fn	kernels::ssim_sums16_16;
+kernels::saxpy_fn	kernels::saxpy;
+kernels::fdct8x8_fn	kernels::fdct8x8;
+kernels::rgb_2_hsi_fn	kernels::rgb_2_hsi;
+
+kernels::isa_level kernels::max_isa(void) {
+	if (avx2_built && has_avx2()) return ISA_AVX2;
+#if defined(__SSE2__)
+	if (has_sse2()) return ISA_SSE2;
+#endif
+	return ISA_C;
+}
+
+void kernels::set_isa(const isa_level& level) {
+	if (level > max_isa())
+		throw std::runtime_error(std::string("Kernels for ") + isa_names[level] + " not supported by this cpu or build");
+	sse = pick<sse_fn>(level, sse_c, sse_sse2, sse_avx2);
+	sse16 = pick<sse16_fn>(level, sse16_c, sse16_sse2, sse16_avx2);
+	ssim_4x4x2 = pick<ssim_4x4x2_fn>(level, ssim_4x4x2_c, ssim_4x4x2_sse2, 0);
+	ssim_sums_4 = pick<ssim_sums_fn>(level, ssim_sums_c<4>, ssim_sums_sse2<4>, 0);
+	ssim_sums_8 = pick<ssim_sums_fn>(level, ssim_sums_c<8>, ssim_sums_sse2<8>, 0);
+	ssim_sums_16 = pick<ssim_sums_fn>(level, ssim_sums_c<16>, ssim_sums_sse2<16>, 0);
+	ssim_sums16_4 = pick<ssim_sums16_fn>(level, ssim_sums16_c<4>, ssim_sums16_sse2<4>, 0);
+	ssim_sums16_8 = pick<ssim_sums16_fn>(level, ssim_sums16_c<8>, ssim_sums16_sse2<8>, 0);
+	ssim_sums16_16 = pick<ssim_sums16_fn>(level, ssim_sums16_c<16>, ssim_sums16_sse2<16>, 0);
+	saxpy = pick<saxpy_fn>(level, saxpy_c, saxpy_sse2, saxpy_avx2);
+	fdct8x8 = pick<fdct8x8_fn>(level, fdct8x8_c, fdct8x8_sse2, 0);
+	rgb_2_hsi = pick<rgb_2_hsi_fn>(level, rgb_2_hsi_c, 0, rgb_2_hsi_avx2);
+	cur_isa = level;
+}
+
+void kernels::set_isa(const std::string& name) {
+	for(int i = ISA_C; i <= ISA_AVX2; ++i)
+		if (name == isa_names[i]) {
+			set_isa((isa_level)i);
+			return;
+		}
+	throw std::runtime_error("Unknown kernels (use c, sse2 or avx2)");
+}
+
+const char* kernels::isa(void) {
+	return isa_names[cur_isa];
+}
+
+namespace {
+	// the best kernels are bound before main
+	struct isa_setup {
+		isa_setup() {
+			kernels::set_isa(kernels::max_isa());
+		}
+	} isa_init;
+}
+
+namespace {
+	// hue from u = R-G and v = R-B, as (R-B)*(G-B) = v*(v-u)
+	unsigned char hsi_hue(const int& u, const int& v) {
+		const static double PI = 3.14159265;
+		const int	den_2 = u*u + v*(v-u);
+		// grays (0/0) have always been 1.0
+		if (!den_2) return 255;
+		const double	c = 0.5*(u + v) / sqrt((double)den_2),
+				h = std::max(0.0, std::min(1.0, acos(std::max(-1.0, std::min(1.0, c)))/PI));
+		return 255.0*h + 0.5;
+	}
+}
+
+// The hue of every pair is taken from hsi_hue() (511x511 bytes), so
+// there is no acos or sqrt per pixel and no error at all.
+// The division of S is a multiplication by a 32 bit reciprocal,
+// exact here as numerator*(m*d - 2^32) < 2^19*2^11 < 2^32
+kernels::hsi_tables::hsi_tables() : hue(511*511 + 3) {
+	for(int u = -255; u <= 255; ++u)
+		for(int v = -255; v <= 255; ++v)
+			hue[(u + 255)*511 + v + 255] = hsi_hue(u, v);
+	rcp[0] = 0;
+	for(unsigned int sum = 1; sum < 766; ++sum)
+		rcp[sum] = ((1ULL << 32) + 2*sum - 1)/(2*sum);
+}
+
+const kernels::hsi_tables& kernels::get_hsi_tables(void) {
+	static const hsi_tables	t;
+	return t;
+}
+
+void kernels::rgb_2_hsi_c(const unsigned char *src, unsigned char *dst, const int& sz) {
+	const hsi_tables	&t = get_hsi_tables();
+	for(int j = 0; j < sz; j += 3) {
+		const int	r = src[j+0],
+				g = src[j+1],
+				b = src[j+2],
+				sum = r + g + b;
+		dst[j+0] = t.hue[(r - g + 255)*511 + r - b + 255];
+		// floor(255*S + 0.5), black gets S 255 as with the float formula
+		dst[j+1] = sum ? ((unsigned long long)(511*sum - 1530*std::min(r, std::min(g, b)))*t.rcp[sum]) >> 32 : 255;
+		dst[j+2] = (sum + 1)/3;
+	}
+}
+
+unsigned long long kernels::sse_c(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h) {
+	unsigned long long	sse = 0;
+	for(unsigned int j = 0; j < h; ++j, ref += ref_ls, cmp += cmp_ls)
+		// 65536 samples (65025 at most each) fit in 32 bits
+		for(unsigned int i0 = 0; i0 < w; i0 += 65536) {
+			const unsigned int	i_end = (w - i0 > 65536) ? i0 + 65536 : w;
+			unsigned int		part = 0;
+			for(unsigned int i = i0; i < i_end; ++i) {
+				const int	diff = ref[i]-cmp[i];
+				part += diff*diff;
+			}
+			sse += part;
+		}
+	return sse;
+}
+
+unsigned long long kernels::sse_sse2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h) {
+#if defined(__SSE2__)
+	const __m128i		zero = _mm_setzero_si128();
+	const unsigned int	w16 = w & ~15U;
+	__m128i			acc = zero;
+	unsigned long long	tail = 0;
+	for(unsigned int j = 0; j < h; ++j, ref += ref_ls, cmp += cmp_ls) {
+		// each 32 bit lane gets at most 4*65025 every 16 samples,
+		// widen to 64 bits every 65536 samples
+		for(unsigned int i0 = 0; i0 < w16; i0 += 65536) {
+			const unsigned int	i_end = (w16 - i0 > 65536) ? i0 + 65536 : w16;
+			__m128i			part = zero;
+			for(unsigned int i = i0; i < i_end; i += 16) {
+				const __m128i	r = _mm_loadu_si128((const __m128i*)(ref + i)),
+						c = _mm_loadu_si128((const __m128i*)(cmp + i)),
+						d_lo = _mm_sub_epi16(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(c, zero)),
+						d_hi = _mm_sub_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(c, zero));
+				part = _mm_add_epi32(part, _mm_madd_epi16(d_lo, d_lo));
+				part = _mm_add_epi32(part, _mm_madd_epi16(d_hi, d_hi));
+			}
+			acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(part, zero));
+			acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(part, zero));
+		}
+		for(unsigned int i = w16; i < w; ++i) {
+			const int	diff = ref[i]-cmp[i];
+			tail += diff*diff;
+		}
+	}
+	return hsum_epi64(acc) + tail;
+#else
+	return sse_c(ref, ref_ls, cmp, cmp_ls, w, h);
+#endif
+}
+
+unsigned long long kernels::sse16_c(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h) {
+	unsigned long long	sse = 0;
+	for(unsigned int j = 0; j < h; ++j, ref += ref_ls, cmp += cmp_ls)
+		for(unsigned int i = 0; i < w; ++i) {
+			const int	diff = ref[i]-cmp[i];
+			sse += (unsigned int)(diff*diff);
+		}
+	return sse;
+}
+
+bool kernels::above_depth16(const unsigned short *p, const int& ls, const unsigned int& w, const unsigned int& h, const int& depth) {
+	unsigned int	bits = 0;
+	for(unsigned int j = 0; j < h; ++j, p += ls)
+		for(unsigned int i = 0; i < w; ++i)
+			bits |= p[i];
+	return 0 != (bits >> depth);
+}
+
+unsigned long long kernels::sse16_sse2(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h) {
+#if defined(__SSE2__)
+	const __m128i		zero = _mm_setzero_si128();
+	const unsigned int	w8 = w & ~7U;
+	__m128i			acc = zero;
+	unsigned long long	tail = 0;
+	for(unsigned int j = 0; j < h; ++j, ref += ref_ls, cmp += cmp_ls) {
+		// the differences fit 16 bits, a 32 bit lane gets at
+		// most 2*4095^2 every 8 samples: widen every 512
+		for(unsigned int i0 = 0; i0 < w8; i0 += 512) {
+			const unsigned int	i_end = (w8 - i0 > 512) ? i0 + 512 : w8;
+			__m128i			part = zero;
+			for(unsigned int i = i0; i < i_end; i += 8) {
+				const __m128i	d = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(ref + i)), _mm_loadu_si128((const __m128i*)(cmp + i)));
+				part = _mm_add_epi32(part, _mm_madd_epi16(d, d));
+			}
+			acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(part, zero));
+			acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(part, zero));
+		}
+		for(unsigned int i = w8; i < w; ++i) {
+			const int	diff = ref[i]-cmp[i];
+			tail += diff*diff;
+		}
+	}
+	return hsum_epi64(acc) + tail;
+#else
+	return sse16_c(ref, ref_ls, cmp, cmp_ls, w, h);
+#endif
+}
+
+void kernels::ssim_4x4x2_c(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, int sums[2][4]) {
+	for(int b = 0; b < 2; ++b, ref += 4, cmp += 4) {
+		int	s_r = 0, s_c = 0, ss = 0, s_rc = 0;
+		for(int j = 0; j < 4; ++j)
+			for(int i = 0; i < 4; ++i) {
+				const int	c_ref = ref[i + j*ref_ls],
+						c_cmp = cmp[i + j*cmp_ls];
+				s_r += c_ref;
+				s_c += c_cmp;
+				ss += c_ref*c_ref + c_cmp*c_cmp;
+				s_rc += c_ref*c_cmp;
+			}
+		sums[b][0] = s_r;
+		sums[b][1] = s_c;
+		sums[b][2] = ss;
+		sums[b][3] = s_rc;
+	}
+}
+
+void kernels::ssim_4x4x2_sse2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, int sums[2][4]) {
+#if defined(__SSE2__)
+	// 8 samples per row, the 32 bit lanes 0-1 belong to the
+	// first block and 2-3 to the second one
+	const __m128i	zero = _mm_setzero_si128(),
+			ones = _mm_set1_epi16(1);
+	__m128i		s_r = zero, s_c = zero, ss = zero, s_rc = zero;
+	for(int j = 0; j < 4; ++j) {
+		const __m128i	r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(ref + j*ref_ls)), zero),
+				c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cmp + j*cmp_ls)), zero);
+		s_r = _mm_add_epi32(s_r, _mm_madd_epi16(r, ones));
+		s_c = _mm_add_epi32(s_c, _mm_madd_epi16(c, ones));
+		ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(r, r), _mm_madd_epi16(c, c)));
+		s_rc = _mm_add_epi32(s_rc, _mm_madd_epi16(r, c));
+	}
+	// add lane pairs, the block sums end up in lanes 0 and 2
+	int	v[4][4];
+	_mm_storeu_si128((__m128i*)v[0], _mm_add_epi32(s_r, _mm_shuffle_epi32(s_r, _MM_SHUFFLE(2, 3, 0, 1))));
+	_mm_storeu_si128((__m128i*)v[1], _mm_add_epi32(s_c, _mm_shuffle_epi32(s_c, _MM_SHUFFLE(2, 3, 0, 1))));
+	_mm_storeu_si128((__m128i*)v[2], _mm_add_epi32(ss, _mm_shuffle_epi32(ss, _MM_SHUFFLE(2, 3, 0, 1))));
+	_mm_storeu_si128((__m128i*)v[3], _mm_add_epi32(s_rc, _mm_shuffle_epi32(s_rc, _MM_SHUFFLE(2, 3, 0, 1))));
+	for(int i = 0; i < 4; ++i) {
+		sums[0][i] = v[i][0];
+		sums[1][i] = v[i][2];
+	}
+#else
+	ssim_4x4x2_c(ref, ref_ls, cmp, cmp_ls, sums);
+#endif
+}
+
+template<unsigned int B>
+void kernels::ssim_sums_c(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& n, unsigned int sums[][5]) {
+	for(unsigned int b = 0; b < n; ++b, ref += B, cmp += B) {
+		unsigned int	s_r = 0, s_c = 0, s_rr = 0, s_cc = 0, s_rc = 0;
+		for(unsigned int j = 0; j < B; ++j)
+			for(unsigned int i = 0; i < B; ++i) {
+				const unsigned int	c_ref = ref[i + j*ref_ls],
+							c_cmp = cmp[i + j*cmp_ls];
+				s_r += c_ref;
+				s_c += c_cmp;
+				s_rr += c_ref*c_ref;
+				s_cc += c_cmp*c_cmp;
+				s_rc += c_ref*c_cmp;
+			}
+		sums[b][0] = s_r;
+		sums[b][1] = s_c;
+		sums[b][2] = s_rr;
+		sums[b][3] = s_cc;
+		sums[b][4] = s_rc;
+	}
+}
+
+template<unsigned int B>
+void kernels::ssim_sums_sse2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& n, unsigned int sums[][5]) {
+#if defined(__SSE2__)
+	// psadbw for the sums, pmaddwd for the products: a 16x16
+	// block gets at most 256*65025 in a 32 bit lane
+	const __m128i	zero = _mm_setzero_si128();
+	for(unsigned int b = 0; b < n; ++b, ref += B, cmp += B) {
+		__m128i	s_r = zero, s_c = zero, s_rr = zero, s_cc = zero, s_rc = zero;
+		for(unsigned int j = 0; j < B; ++j) {
+			const unsigned char	*p_r = ref + j*ref_ls,
+						*p_c = cmp + j*cmp_ls;
+			__m128i			r, c;
+			if (4 == B) {
+				int	v_r, v_c;
+				memcpy(&v_r, p_r, 4);
+				memcpy(&v_c, p_c, 4);
+				r = _mm_cvtsi32_si128(v_r);
+				c = _mm_cvtsi32_si128(v_c);
+			} else if (8 == B) {
+				r = _mm_loadl_epi64((const __m128i*)p_r);
+				c = _mm_loadl_epi64((const __m128i*)p_c);
+			} else {
+				r = _mm_loadu_si128((const __m128i*)p_r);
+				c = _mm_loadu_si128((const __m128i*)p_c);
+			}
+			s_r = _mm_add_epi32(s_r, _mm_sad_epu8(r, zero));
+			s_c = _mm_add_epi32(s_c, _mm_sad_epu8(c, zero));
+			const __m128i	r_lo = _mm_unpacklo_epi8(r, zero),
+					c_lo = _mm_unpacklo_epi8(c, zero);
+			s_rr = _mm_add_epi32(s_rr, _mm_madd_epi16(r_lo, r_lo));
+			s_cc = _mm_add_epi32(s_cc, _mm_madd_epi16(c_lo, c_lo));
+			s_rc = _mm_add_epi32(s_rc, _mm_madd_epi16(r_lo, c_lo));
+			if (16 == B) {
+				const __m128i	r_hi = _mm_unpackhi_epi8(r, zero),
+						c_hi = _mm_unpackhi_epi8(c, zero);
+				s_rr = _mm_add_epi32(s_rr, _mm_madd_epi16(r_hi, r_hi));
+				s_cc = _mm_add_epi32(s_cc, _mm_madd_epi16(c_hi, c_hi));
+				s_rc = _mm_add_epi32(s_rc, _mm_madd_epi16(r_hi, c_hi));
+			}
+		}
+		sums[b][0] = hsum_epi32(s_r);
+		sums[b][1] = hsum_epi32(s_c);
+		sums[b][2] = hsum_epi32(s_rr);
+		sums[b][3] = hsum_epi32(s_cc);
+		sums[b][4] = hsum_epi32(s_rc);
+	}
+#else
+	ssim_sums_c<B>(ref, ref_ls, cmp, cmp_ls, n, sums);
+#endif
+}
+
+template void kernels::ssim_sums_c<4>(const unsigned char*, const int&, const unsigned char*, const int&, const unsigned int&, unsigned int[][5]);
+template void kernels::ssim_sums_c<8>(const unsigned char*, const int&, const unsigned char*, const int&, const unsigned int&, unsigned int[][5]);
+template void kernels::ssim_sums_c<16>(const unsigned char*, const int&, const unsigned char*, const int&, const unsigned int&, unsigned int[][5]);
+template void kernels::ssim_sums_sse2<4>(const unsigned char*, const int&, const unsigned char*, const int&, const unsigned int&, unsigned int[][5]);
+template void kernels::ssim_sums_sse2<8>(const unsigned char*, const int&, const unsigned char*, const int&, const unsigned int&, unsigned int[][5]);
+template void kernels::ssim_sums_sse2<16>(const unsigned char*, const int&, const unsigned char*, const int&, const unsigned int&, unsigned int[][5]);
+
+template<unsigned int B>
+void kernels::ssim_sums16_c(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& n, unsigned long long sums[][5]) {
+	for(unsigned int b = 0; b < n; ++b, ref += B, cmp += B) {
+		unsigned long long	s_r = 0, s_c = 0, s_rr = 0, s_cc = 0, s_rc = 0;
+		for(unsigned int j = 0; j < B; ++j)
+			for(unsigned int i = 0; i < B; ++i) {
+				const unsigned int	c_ref = ref[i + j*ref_ls],
+							c_cmp = cmp[i + j*cmp_ls];
+				s_r += c_ref;
+				s_c += c_cmp;
+				s_rr += c_ref*c_ref;
+				s_cc += c_cmp*c_cmp;
+				s_rc += c_ref*c_cmp;
+			}
+		sums[b][0] = s_r;
+		sums[b][1] = s_c;
+		sums[b][2] = s_rr;
+		sums[b][3] = s_cc;
+		sums[b][4] = s_rc;
+	}
+}
+
+template<unsigned int B>
+void kernels::ssim_sums16_sse2(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& n, unsigned long long sums[][5]) {
+#if defined(__SSE2__)
+	// pmaddwd for both the sums (by 1) and the products: 12 bit
+	// samples are positive as signed 16 bit and a 16x16 block
+	// gets at most 256*4095^2, which still fits 32 bits
+	const __m128i	zero = _mm_setzero_si128(),
+			ones = _mm_set1_epi16(1);
+	for(unsigned int b = 0; b < n; ++b, ref += B, cmp += B) {
+		__m128i	s_r = zero, s_c = zero, s_rr = zero, s_cc = zero, s_rc = zero;
+		for(unsigned int j = 0; j < B; ++j) {
+			const unsigned short	*p_r = ref + j*ref_ls,
+						*p_c = cmp + j*cmp_ls;
+			for(unsigned int i = 0; i < B; i += 8) {
+				__m128i	r, c;
+				if (4 == B) {
+					r = _mm_loadl_epi64((const __m128i*)p_r);
+					c = _mm_loadl_epi64((const __m128i*)p_c);
+				} else {
+					r = _mm_loadu_si128((const __m128i*)(p_r + i));
+					c = _mm_loadu_si128((const __m128i*)(p_c + i));
+				}
+				s_r = _mm_add_epi32(s_r, _mm_madd_epi16(r, ones));
+				s_c = _mm_add_epi32(s_c, _mm_madd_epi16(c, ones));
+				s_rr = _mm_add_epi32(s_rr, _mm_madd_epi16(r, r));
+				s_cc = _mm_add_epi32(s_cc, _mm_madd_epi16(c, c));
+				s_rc = _mm_add_epi32(s_rc, _mm_madd_epi16(r, c));
+			}
+		}
+		sums[b][0] = hsum_epi32(s_r);
+		sums[b][1] = hsum_epi32(s_c);
+		sums[b][2] = hsum_epi32(s_rr);
+		sums[b][3] = hsum_epi32(s_cc);
+		sums[b][4] = hsum_epi32(s_rc);
+	}
+#else
+	ssim_sums16_c<B>(ref, ref_ls, cmp, cmp_ls, n, sums);
+#endif
+}
+
+template void kernels::ssim_sums16_c<4>(const unsigned short*, const int&, const unsigned short*, const int&, const unsigned int&, unsigned long long[][5]);
+template void kernels::ssim_sums16_c<8>(const unsigned short*, const int&, const unsigned short*, const int&, const unsigned int&, unsigned long long[][5]);
+template void kernels::ssim_sums16_c<16>(const unsigned short*, const int&, const unsigned short*, const int&, const unsigned int&, unsigned long long[][5]);
+template void kernels::ssim_sums16_sse2<4>(const unsigned short*, const int&, const unsigned short*, const int&, const unsigned int&, unsigned long long[][5]);
+template void kernels::ssim_sums16_sse2<8>(const unsigned short*, const int&, const unsigned short*, const int&, const unsigned int&, unsigned long long[][5]);
+template void kernels::ssim_sums16_sse2<16>(const unsigned short*, const int&, const unsigned short*, const int&, const unsigned int&, unsigned long long[][5]);
+
+void kernels::saxpy_c(float *y, const float *x, const float& a, const unsigned int& n) {
+	for(unsigned int i = 0; i < n; ++i)
+		y[i] += a*x[i];
+}
+
+void kernels::saxpy_sse2(float *y, const float *x, const float& a, const unsigned int& n) {
+#if defined(__SSE2__)
+	const __m128		v_a = _mm_set1_ps(a);
+	const unsigned int	n4 = n & ~3U;
+	for(unsigned int i = 0; i < n4; i += 4)
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(v_a, _mm_loadu_ps(x + i))));
+	for(unsigned int i = n4; i < n; ++i)
+		y[i] += a*x[i];
+#else
+	saxpy_c(y, x, a, n);
+#endif
+}
+
+void kernels::fdct8x8_c(const unsigned char *src, const int& ls, float out[64]) {
+	float	x[64],
+		t[64];
+	for(int j = 0; j < 8; ++j)
+		for(int i = 0; i < 8; ++i)
+			x[8*j + i] = src[j*ls + i];
+	// columns, then rows
+	for(int i = 0; i < 8; ++i)
+		dct8(x + i, 8, t + i, 8);
+	for(int j = 0; j < 8; ++j)
+		dct8(t + 8*j, 1, out + 8*j, 1);
+}
+
+void kernels::fdct8x8_sse2(const unsigned char *src, const int& ls, float out[64]) {
+#if defined(__SSE2__)
+	const __m128i	zero = _mm_setzero_si128();
+	__m128		lo[8],
+			hi[8];
+	for(int j = 0; j < 8; ++j) {
+		const __m128i	p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + j*ls)), zero);
+		lo[j] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p, zero));
+		hi[j] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p, zero));
+	}
+	// columns, then the rows as columns of the transposed block
+	dct8_ps(lo);
+	dct8_ps(hi);
+	transpose8_ps(lo, hi);
+	dct8_ps(lo);
+	dct8_ps(hi);
+	transpose8_ps(lo, hi);
+	for(int j = 0; j < 8; ++j) {
+		_mm_storeu_ps(out + 8*j, lo[j]);
+		_mm_storeu_ps(out + 8*j + 4, hi[j]);
+	}
+#else
+	fdct8x8_c(src, ls, out);
+#endif
+}
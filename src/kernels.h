@@ -0,0 +1,155 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <string>
+#include <vector>
+
+namespace kernels {
+	// sum of squared errors of a w x h block of 8 bit samples,
+	// accumulated in integers: every implementation gives
+	// exactly the same result
+	typedef unsigned long long (*sse_fn)(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+
+	extern unsigned long long sse_c(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+	extern unsigned long long sse_sse2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+	extern unsigned long long sse_avx2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+
+	// the same on 16 bit samples of up to 12 bits (high bit depth
+	// frames), linesizes in samples. The SIMD versions work in signed
+	// 16 bits: on larger samples the levels give different results,
+	// callers have to make sure of the range (see above_depth16)
+	typedef unsigned long long (*sse16_fn)(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+
+	extern unsigned long long sse16_c(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+	extern unsigned long long sse16_sse2(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+	extern unsigned long long sse16_avx2(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h);
+
+	// whether a w x h block of 16 bit samples has some above depth
+	// bits, ie. a raw file which isn't what it has been told to be
+	extern bool above_depth16(const unsigned short *p, const int& ls, const unsigned int& w, const unsigned int& h, const int& depth);
+
+	// sums of two horizontally adjacent 4x4 blocks, as in x264:
+	// sums[b] = { sum ref, sum cmp, sum ref^2 + cmp^2, sum ref*cmp }
+	typedef void (*ssim_4x4x2_fn)(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, int sums[2][4]);
+
+	extern void ssim_4x4x2_c(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, int sums[2][4]);
+	extern void ssim_4x4x2_sse2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, int sums[2][4]);
+
+	// sums of n adjacent B x B blocks (B = 4, 8 or 16) for the block
+	// ssim, sums[b] = { sum ref, sum cmp, sum ref^2, sum cmp^2, sum ref*cmp }.
+	// B is known at compile time so that the loops get unrolled
+	typedef void (*ssim_sums_fn)(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& n, unsigned int sums[][5]);
+
+	template<unsigned int B>
+	void ssim_sums_c(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& n, unsigned int sums[][5]);
+	template<unsigned int B>
+	void ssim_sums_sse2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& n, unsigned int sums[][5]);
+
+	// the same on 16 bit samples of up to 12 bits (as sse16), linesizes
+	// in samples and 64 bit sums
+	typedef void (*ssim_sums16_fn)(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& n, unsigned long long sums[][5]);
+
+	template<unsigned int B>
+	void ssim_sums16_c(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& n, unsigned long long sums[][5]);
+	template<unsigned int B>
+	void ssim_sums16_sse2(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& n, unsigned long long sums[][5]);
+
+	// y[i] += a*x[i] on floats, a step of separable filters.
+	// No fused multiply-add, so all the versions give the same result
+	typedef void (*saxpy_fn)(float *y, const float *x, const float& a, const unsigned int& n);
+
+	extern void saxpy_c(float *y, const float *x, const float& a, const unsigned int& n);
+	extern void saxpy_sse2(float *y, const float *x, const float& a, const unsigned int& n);
+	extern void saxpy_avx2(float *y, const float *x, const float& a, const unsigned int& n);
+
+	// orthonormal 2D DCT-II of an 8x8 block of 8 bit samples (as
+	// matlab's dct2), out[8*k + l] has vertical frequency k and
+	// horizontal frequency l. Same float operations in all versions
+	typedef void (*fdct8x8_fn)(const unsigned char *src, const int& ls, float out[64]);
+
+	extern void fdct8x8_c(const unsigned char *src, const int& ls, float out[64]);
+	extern void fdct8x8_sse2(const unsigned char *src, const int& ls, float out[64]);
+
+	// rgb24 to hsi, sz bytes (whole pixels) from src to dst.
+	// H = cos^-1((((R-G)+(R-B))/2)/sqrt((R-G)^2 + (R-B)*(G-B))),
+	// S = 1 - (3/(R+G+B))*min(R,G,B) and I = (1/3)*(R+G+B), all
+	// rounded to 8 bits. Table driven, every version gives the bytes
+	// of the per pixel formula
+	typedef void (*rgb_2_hsi_fn)(const unsigned char *src, unsigned char *dst, const int& sz);
+
+	extern void rgb_2_hsi_c(const unsigned char *src, unsigned char *dst, const int& sz);
+	extern void rgb_2_hsi_avx2(const unsigned char *src, unsigned char *dst, const int& sz);
+
+	// tables of rgb_2_hsi: the hue of every (R-G, R-B) pair at
+	// hue[(R-G+255)*511 + R-B+255] (plus 3 bytes, for 32 bit
+	// gathers) and 32 bit reciprocals of 2*sum for S. Built on first
+	// use, which has to happen before the kernels run on several
+	// threads
+	struct hsi_tables {
+		std::vector<unsigned char>	hue;
+		unsigned int			rcp[766];
+
+		hsi_tables();
+	};
+
+	extern const hsi_tables& get_hsi_tables(void);
+
+	// the ones set_isa has bound, by default the best for this cpu
+	extern sse_fn sse;
+	extern sse16_fn sse16;
+	extern ssim_4x4x2_fn ssim_4x4x2;
+	extern ssim_sums_fn ssim_sums_4;
+	extern ssim_sums_fn ssim_sums_8;
+	extern ssim_sums_fn ssim_sums_16;
+	extern ssim_sums16_fn ssim_sums16_4;
+	extern ssim_sums16_fn ssim_sums16_8;
+	extern ssim_sums16_fn ssim_sums16_16;
+	extern saxpy_fn saxpy;
+	extern fdct8x8_fn fdct8x8;
+	extern rgb_2_hsi_fn rgb_2_hsi;
+
+	// whether kernels_avx2.cpp has been built with avx2 enabled
+	extern const bool avx2_built;
+
+	// instruction sets the kernels come in, each one includes the
+	// ones before it
+	enum isa_level {
+		ISA_C = 0,
+		ISA_SSE2,
+		ISA_AVX2
+	};
+
+	// best level supported by both this build and the cpu (cpuid)
+	extern isa_level max_isa(void);
+
+	// bind every kernel to its best version up to level (ie. to
+	// check the other versions), throws if max_isa is below it
+	extern void set_isa(const isa_level& level);
+
+	// the same by name: "c", "sse2" or "avx2"
+	extern void set_isa(const std::string& name);
+
+	// name of the instruction set the kernels use ("c", "sse2", "avx2")
+	extern const char* isa(void);
+}
+
+#endif /*_KERNELS_H_*/
@@ -0,0 +1,152 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// this file is built with -mavx2, its kernels are only
+// called when the cpu has avx2 (see kernels.cpp)
+#include "kernels.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+const bool	kernels::avx2_built = true;
+#else
+const bool	kernels::avx2_built = false;
+#endif
+
+unsigned long long kernels::sse_avx2(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h) {
+#if defined(__AVX2__)
+	const __m256i		zero = _mm256_setzero_si256();
+	const unsigned int	w32 = w & ~31U;
+	__m256i			acc = zero;
+	unsigned long long	tail = 0;
+	for(unsigned int j = 0; j < h; ++j, ref += ref_ls, cmp += cmp_ls) {
+		// as sse_sse2, widen every 65536 samples
+		for(unsigned int i0 = 0; i0 < w32; i0 += 65536) {
+			const unsigned int	i_end = (w32 - i0 > 65536) ? i0 + 65536 : w32;
+			__m256i			part = zero;
+			for(unsigned int i = i0; i < i_end; i += 32) {
+				// unpacking works within the 128 bit halves, the
+				// order doesn't matter for a sum
+				const __m256i	r = _mm256_loadu_si256((const __m256i*)(ref + i)),
+						c = _mm256_loadu_si256((const __m256i*)(cmp + i)),
+						d_lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(r, zero), _mm256_unpacklo_epi8(c, zero)),
+						d_hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(r, zero), _mm256_unpackhi_epi8(c, zero));
+				part = _mm256_add_epi32(part, _mm256_madd_epi16(d_lo, d_lo));
+				part = _mm256_add_epi32(part, _mm256_madd_epi16(d_hi, d_hi));
+			}
+			acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(part, zero));
+			acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(part, zero));
+		}
+		for(unsigned int i = w32; i < w; ++i) {
+			const int	diff = ref[i]-cmp[i];
+			tail += diff*diff;
+		}
+	}
+	unsigned long long	l[4];
+	_mm256_storeu_si256((__m256i*)l, acc);
+	return l[0] + l[1] + l[2] + l[3] + tail;
+#else
+	return sse_sse2(ref, ref_ls, cmp, cmp_ls, w, h);
+#endif
+}
+
+unsigned long long kernels::sse16_avx2(const unsigned short *ref, const int& ref_ls, const unsigned short *cmp, const int& cmp_ls, const unsigned int& w, const unsigned int& h) {
+#if defined(__AVX2__)
+	const __m256i		zero = _mm256_setzero_si256();
+	const unsigned int	w16 = w & ~15U;
+	__m256i			acc = zero;
+	unsigned long long	tail = 0;
+	for(unsigned int j = 0; j < h; ++j, ref += ref_ls, cmp += cmp_ls) {
+		// as sse16_sse2, widen every 1024 samples
+		for(unsigned int i0 = 0; i0 < w16; i0 += 1024) {
+			const unsigned int	i_end = (w16 - i0 > 1024) ? i0 + 1024 : w16;
+			__m256i			part = zero;
+			for(unsigned int i = i0; i < i_end; i += 16) {
+				const __m256i	d = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(ref + i)), _mm256_loadu_si256((const __m256i*)(cmp + i)));
+				part = _mm256_add_epi32(part, _mm256_madd_epi16(d, d));
+			}
+			acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(part, zero));
+			acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(part, zero));
+		}
+		for(unsigned int i = w16; i < w; ++i) {
+			const int	diff = ref[i]-cmp[i];
+			tail += diff*diff;
+		}
+	}
+	unsigned long long	l[4];
+	_mm256_storeu_si256((__m256i*)l, acc);
+	return l[0] + l[1] + l[2] + l[3] + tail;
+#else
+	return sse16_sse2(ref, ref_ls, cmp, cmp_ls, w, h);
+#endif
+}
+
+void kernels::saxpy_avx2(float *y, const float *x, const float& a, const unsigned int& n) {
+#if defined(__AVX2__)
+	const __m256		v_a = _mm256_set1_ps(a);
+	const unsigned int	n8 = n & ~7U;
+	for(unsigned int i = 0; i < n8; i += 8)
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(v_a, _mm256_loadu_ps(x + i))));
+	for(unsigned int i = n8; i < n; ++i)
+		y[i] += a*x[i];
+#else
+	saxpy_sse2(y, x, a, n);
+#endif
+}
+
+void kernels::rgb_2_hsi_avx2(const unsigned char *src, unsigned char *dst, const int& sz) {
+#if defined(__AVX2__)
+	const hsi_tables	&t = get_hsi_tables();
+	// 4 pixels of a 16 byte load to r0..r3 g0..g3 b0..b3, and back
+	const __m128i		deint = _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1);
+	const __m256i		inter = _mm256_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1,
+							0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1),
+				zero = _mm256_setzero_si256(),
+				c255 = _mm256_set1_epi32(255),
+				c511 = _mm256_set1_epi32(511),
+				c1530 = _mm256_set1_epi32(1530),
+				c_i = _mm256_set1_epi32(21846);
+	int			j = 0;
+	// 8 pixels a step, loads and stores reach 4 bytes past them
+	for(; j + 28 <= sz; j += 24) {
+		const __m128i	a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + j)), deint),
+				b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + j + 12)), deint),
+				rg = _mm_unpacklo_epi32(a, b),
+				bx = _mm_unpackhi_epi32(a, b);
+		const __m256i	r = _mm256_cvtepu8_epi32(rg),
+				g = _mm256_cvtepu8_epi32(_mm_srli_si128(rg, 8)),
+				bl = _mm256_cvtepu8_epi32(bx),
+				sum = _mm256_add_epi32(r, _mm256_add_epi32(g, bl)),
+				idx = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(_mm256_sub_epi32(r, g), c255), c511), _mm256_add_epi32(_mm256_sub_epi32(r, bl), c255)),
+				h = _mm256_and_si256(_mm256_i32gather_epi32((const int*)&t.hue[0], idx, 1), c255),
+				num = _mm256_sub_epi32(_mm256_mullo_epi32(sum, c511), _mm256_mullo_epi32(_mm256_min_epi32(r, _mm256_min_epi32(g, bl)), c1530)),
+				rcp = _mm256_i32gather_epi32((const int*)t.rcp, sum, 4),
+				// high halves of the 64 bit products, even and odd lanes
+				s_even = _mm256_srli_epi64(_mm256_mul_epu32(num, rcp), 32),
+				s_odd = _mm256_mul_epu32(_mm256_srli_epi64(num, 32), _mm256_srli_epi64(rcp, 32)),
+				s = _mm256_blendv_epi8(_mm256_blend_epi32(s_even, s_odd, 0xAA), c255, _mm256_cmpeq_epi32(sum, zero)),
+				// (sum + 1)/3, exact up to 766
+				i = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(1)), c_i), 16),
+				out = _mm256_shuffle_epi8(_mm256_packus_epi16(_mm256_packus_epi32(h, s), _mm256_packus_epi32(i, zero)), inter);
+		_mm_storeu_si128((__m128i*)(dst + j), _mm256_castsi256_si128(out));
+		_mm_storeu_si128((__m128i*)(dst + j + 12), _mm256_extracti128_si256(out, 1));
+	}
+	rgb_2_hsi_c(src + j, dst + j, sz - j);
+#else
+	rgb_2_hsi_c(src, dst, sz);
+#endif
+}
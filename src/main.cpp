@@ -25,11 +25,14 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <map>
+#include <algorithm>
 #include "mt.h"
 #include "shared_ptr.h"
 #include "qav.h"
+#include "qcache.h"
 #include "settings.h"
 #include "stats.h"
+#include "kernels.h"
 
 template<typename T>
 std::string XtoS(const T& in) {
@@ -44,38 +47,54 @@ std::string get_filename(const std::string& in) {
 	return in;
 }
 
+// a decoded frame waiting for the consumer
+struct vp_slot {
+	qav::frame	buf;
+	int		frame;
+
+	vp_slot() : frame(-1) {
+	}
+};
+typedef mt::Ring<vp_slot>	VP_RING;
+
 class video_producer : public mt::Thread {
-	int				&_frame;
-	mt::Semaphore			&_s_prod,
-					&_s_cons;
-	std::vector<unsigned char>	&_buf;
-	qav::qvideo			&_video;
-	bool				&_exit,
-					&_skip;
+	VP_RING				&_ring;
+	qav::frame_source		&_video;
+	bool				&_exit;
 public:
-	video_producer(int& frame, mt::Semaphore& s_prod, mt::Semaphore& s_cons, std::vector<unsigned char>& buf, qav::qvideo& video, bool& __exit, bool& __skip) : 
-	_frame(frame), _s_prod(s_prod), _s_cons(s_cons), _buf(buf), _video(video), _exit(__exit), _skip(__skip) {
+	video_producer(VP_RING& ring, qav::frame_source& video, bool& __exit) : 
+	_ring(ring), _video(video), _exit(__exit) {
 	}
 
 	virtual void run(void) {
-		while(!_exit) {
-			if (!_video.get_frame(_buf, &_frame, _skip)) _frame = -1;
-			// signal cons we're done
-			_s_cons.pop();
-			// wait for cons to tell us to go
-			_s_prod.push();
+		while(true) {
+			// wait for a free slot, we can be ahead
+			// of the consumer by the ring size
+			vp_slot	&slot = _ring.get_free();
+			if (_exit) break;
+			int	frame = -1;
+			if (!_video.get_frame(slot.buf, &frame)) frame = -1;
+			slot.frame = frame;
+			_ring.put_full();
+			// nothing more to give
+			if (-1 == frame) break;
 		}
 	}
 };
 
-typedef std::vector<unsigned char>	VUCHAR;
-typedef shared_ptr<qav::qvideo>		SP_QVIDEO;
+typedef shared_ptr<qav::frame_source>	SP_QVIDEO;
 struct vp_data {
-	mt::Semaphore	prod;
-	VUCHAR		buf;
-	int		frame;
+	VP_RING		ring;
+	bool		is_over;
 	SP_QVIDEO	video;
 	std::string	name;
+	vp_slot		*next;		// taken from the ring, not yet shown
+	bool		has_cur;	// a frame has been shown
+	unsigned int	n_skipped,
+			n_repeated;
+
+	vp_data(const unsigned int& depth) : ring(depth), is_over(false), next(0), has_cur(false), n_skipped(0), n_repeated(0) {
+	}
 };
 typedef std::vector<shared_ptr<vp_data> >		V_VPDATA;
 typedef std::vector<shared_ptr<video_producer> >	V_VPTH;
@@ -88,19 +107,42 @@ void print_help(void) {
 			"Usage: " << __qpsnr__ << " [options] -r ref.video compare.video1 compare.video2 ...\n\n"
 			"-r,--reference:\n\tset reference video (mandatory)\n"
 			"\n-v,--video-size:\n\tset analysis video size WIDTHxHEIGHT (ie. 1280x720), default is reference video size\n"
-			"\n-s,--skip-frames:\n\tskip n initial frames\n"
+			"\n-s,--skip-frames:\n\tskip n initial frames (seeking on the previous keyframe when the file allows it)\n"
 			"\n-m,--max-frames:\n\tset max frames to process before quit\n"
+			"\n-e,--sample-every:\n\tanalyze one frame every n (frames 1, n+1, 2n+1, ...), the others are not converted\n\tand, when nothing refers to them, not even decoded\n"
 			"\n-I,--save-frames:\n\tsave frames (ppm format)\n"
-			"\n-G,--ignore-fps:\n\tanalyze videos even if the expected fps are different\n"
+			"\n-G,--ignore-fps:\n\tanalyze videos even if the expected fps are different,\n\tframes are always paired by their timestamps\n"
+			"\n-y,--raw-format:\n\tset the format of raw .yuv videos WIDTHxHEIGHT[:pixfmt[:fps]] (ie. 1920x1080:yuv420p:25),\n\tpixfmt is \"yuv420p\" (default), \"yuv422p\", \"yuv444p\", \"yuv420p10le\", \"yuv420p12le\", \"gray\" or \"rgb24\",\n\tfps default is 25. .yuv and .y4m videos are memory mapped instead of being decoded\n"
+			"\n-q,--queue-depth:\n\tset how many frames each video can be decoded ahead of the analyzer, default 3\n"
+			"\n-H,--huge-pages:\n\tback the frame buffers with huge pages\n"
+			"\n-S,--scaler:\n\tset the scaling algorithm (\"fast_bilinear\", \"bilinear\", \"bicubic\", \"point\", \"area\",\n\t\"bicublin\", \"gauss\", \"sinc\", \"lanczos\" or \"spline\"), default \"bicubic\"\n"
+			"\n-Z,--inline-scaling:\n\tscale the frames on the decoder thread, by default they're scaled on a thread pool\n\twhile the next frame gets decoded\n"
+			"\n-C,--cache-dir:\n\tkeep the decoded reference frames in this directory, so that next runs on the same\n\treference (same size, analyzer, scaler and raw format) read them instead of decoding the video again\n"
+			"\n-c,--cache-size:\n\tset the max size of the reference cache in MB, default 10240 (least recently used go first)\n"
+			"\n-t,--decoder-threads:\n\tset the threads each video decoder can use (frame and slice threading),\n\tdefault 0 (half of the cores are split among all the videos, the rest\n\tgoes to scaling and the analyzer)\n"
+			"\n-k,--kernels:\n\tuse the kernels of this instruction set (\"c\", \"sse2\" or \"avx2\"), by default the best one\n\tthe cpu supports\n"
 			"\n-a,--analyzer:\n"
 			"\tpsnr : execute the psnr for each frame\n"
 			"\tavg_psnr : take the average of the psnr every n frames (use option \"fpa\" to set it)\n"
+			"\tplane_psnr : execute the psnr of the Y, Cb and Cr planes and their weighted average for each frame\n"
 			"\tssim : execute the ssim (Y colorspace) on the frames divided in blocks (use option \"blocksize\" to set the size)\n"
 			"\tavg_ssim : take the average of the ssim (Y colorspace) every n frames (use option \"fpa\" to set it)\n"
+			"\tsliding_ssim : execute the ssim (Y colorspace) on windows moved by one pixel, 11x11 gaussian as in\n\t\tWang et al. or a faster box (use options \"window\" and \"winsize\")\n"
+			"\tfast_ssim : execute the ssim (Y colorspace) on 8x8 windows moved by 4 pixels, in integers as in x264\n"
+			"\tms_ssim : execute the multi-scale ssim (Y colorspace) on 5 scales, frames have to be at least 176x176\n"
+			"\tvif : execute the pixel domain visual information fidelity (Y colorspace) on 4 scales\n"
+			"\tpsnr_hvs : execute the psnr-hvs (Y colorspace), csf weighted dct of 8x8 blocks\n"
+			"\tpsnr_hvsm : execute the psnr-hvs-m (Y colorspace), as psnr_hvs with contrast masking\n"
+			"\tseveral analyzers separated by commas (ie. \"psnr,ssim,ms_ssim\") run in one pass on the\n\tsame decoded frames, the options go to all of them\n"
+			"\t10 and 12 bit references are analyzed at their own depth by psnr and avg_psnr (colorspace\n\t\"y\" or \"ycbcr\"), plane_psnr, ssim and avg_ssim, at 8 bits by the others,\n\talso when several analyzers run together\n"
 			"\n-o,--aopts: (specify option1=value1:option2=value2:...)\n"
 			"\tfpa : set the frames per average, default 25\n"
 			"\tcolorspace : set the colorspace (\"rgb\", \"hsi\", \"ycbcr\" or \"y\"), default \"rgb\"\n"
+			"\t\t\"ycbcr\" and \"y\" use the decoded YUV 4:2:0 planes directly\n"
 			"\tblocksize : set blocksize for ssim analysis, default 8\n"
+			"\twindow : set the sliding_ssim window (\"gauss\" or \"box\"), default \"gauss\"\n"
+			"\twinsize : set the size of the sliding_ssim box window, default 8\n"
+			"\tweights : set the Y,Cb,Cr weights of the plane_psnr average, default 6,1,1\n"
 			"\n-l,--log-level:\n"
 			"\t0 : No log\n"
 			"\t1 : Errors only\n"
@@ -122,17 +164,27 @@ int parse_options(int argc, char *argv[], std::map<std::string, std::string>& ao
 		{"analyzer", required_argument, 0, 'a'},
 		{"max-frames", required_argument, 0, 'm'},
 		{"skip-frames", required_argument, 0, 's'},
+		{"sample-every", required_argument, 0, 'e'},
 		{"reference", required_argument, 0, 'r'},
 		{"log-level", required_argument, 0, 'l'},
 		{"save-frames", no_argument, 0, 'I'},
 		{"video-size", required_argument, 0, 'v'},
 		{"ignore-fps", no_argument, 0, 'G'},
+		{"decoder-threads", required_argument, 0, 't'},
+		{"queue-depth", required_argument, 0, 'q'},
+		{"huge-pages", no_argument, 0, 'H'},
+		{"raw-format", required_argument, 0, 'y'},
+		{"scaler", required_argument, 0, 'S'},
+		{"inline-scaling", no_argument, 0, 'Z'},
+		{"cache-dir", required_argument, 0, 'C'},
+		{"cache-size", required_argument, 0, 'c'},
+		{"kernels", required_argument, 0, 'k'},
 		{"help", no_argument, 0, 'h'},
 		{"aopts", required_argument, 0, 'o'},
 		{0, 0, 0, 0}
 	};
 
-	while ((c = getopt_long (argc, argv, "a:l:m:o:r:s:v:hIG", long_options, &option_index)) != -1) {
+	while ((c = getopt_long (argc, argv, "a:c:e:k:l:m:o:q:r:s:t:v:y:C:S:hHIGZ", long_options, &option_index)) != -1) {
 		switch (c) {
 			case 'a':
 				settings::ANALYZER = optarg;
@@ -160,9 +212,51 @@ int parse_options(int argc, char *argv[], std::map<std::string, std::string>& ao
 					if (skip_frames > 0 ) settings::SKIP_FRAMES = skip_frames;
 				}
 				break;
+			case 'e':
+				{
+					const int sample_every = atoi(optarg);
+					if (sample_every > 0 ) settings::SAMPLE_EVERY = sample_every;
+				}
+				break;
 			case 'r':
 				settings::REF_VIDEO = optarg;
 				break;
+			case 'q':
+				{
+					const int queue_depth = atoi(optarg);
+					if (queue_depth > 0 ) settings::FRAME_QUEUE = queue_depth;
+				}
+				break;
+			case 'y':
+				settings::RAW_FORMAT = optarg;
+				break;
+			case 'S':
+				// throws on unknown names
+				qav::scaler::algo(optarg);
+				settings::SCALER = optarg;
+				break;
+			case 'Z':
+				settings::SCALE_STAGE = false;
+				break;
+			case 'C':
+				settings::CACHE_DIR = optarg;
+				break;
+			case 'k':
+				// throws on unknown names or if the cpu can't run them
+				kernels::set_isa(optarg);
+				break;
+			case 'c':
+				{
+					const int cache_size = atoi(optarg);
+					if (cache_size > 0 ) settings::CACHE_SIZE = cache_size;
+				}
+				break;
+			case 't':
+				{
+					const int dec_threads = atoi(optarg);
+					if (dec_threads > 0 ) settings::DECODER_THREADS = dec_threads;
+				}
+				break;
 			case 'm':
 				{
 					const int max_frames = atoi(optarg);
@@ -206,6 +300,9 @@ int parse_options(int argc, char *argv[], std::map<std::string, std::string>& ao
 			case 'G':
 				settings::IGNORE_FPS = true;
 				break;
+			case 'H':
+				settings::HUGE_PAGES = true;
+				break;
 			case 'o':
 				{
 					const char 	*p_opts = optarg,
@@ -224,7 +321,7 @@ int parse_options(int argc, char *argv[], std::map<std::string, std::string>& ao
 				}
 				break;
 			case '?':
-				if (strchr("almorsv", optopt)) {
+				if (strchr("aceklmoqrstvyCS", optopt)) {
 					std::cerr << "Option -" << (char)optopt << " requires an argument" << std::endl;
 					print_help();
 					exit(1);
@@ -259,32 +356,51 @@ namespace producers_utils {
 			(*it)->join();
 	}
 
-	void sync(mt::Semaphore& sem_cons, const int& n_v_th) {
-		for(int i = 0; i < n_v_th; ++i)
-			sem_cons.push();
-	}
-	
-	void lock(mt::Semaphore& sem_cons, mt::Semaphore& ref_prod, V_VPDATA& v_data) {
-		// init all the semaphores
-		sem_cons.push();
-		ref_prod.push();
-		for(V_VPDATA::iterator it = v_data.begin(); it != v_data.end(); ++it)
-			(*it)->prod.push();
-	}
-
-	void unlock(mt::Semaphore& ref_prod, V_VPDATA& v_data) {
-		ref_prod.pop();
+	void unblock(VP_RING& ref_ring, V_VPDATA& v_data) {
+		// producers check the exit flag once they get a slot
+		ref_ring.unblock();
 		for(V_VPDATA::iterator it = v_data.begin(); it != v_data.end(); ++it)
-			(*it)->prod.pop();
-	}
-
-	bool is_frame_skip(const int& frame_num) {
-		return (settings::SKIP_FRAMES > 0) && (settings::SKIP_FRAMES >= frame_num);
+			(*it)->ring.unblock();
 	}
 
 	bool is_last_frame(const int& frame_num) {
 		return (settings::MAX_FRAMES > 0) && (frame_num >= settings::MAX_FRAMES);
 	}
+
+	// Move the video on to the frame shown at max_pts (the last
+	// one with a timestamp not after it), into cur. Frames passed
+	// over are extra ones (ie. duplicated by the encoder), staying
+	// on the same frame repeats it in place of a missing one.
+	// At most one frame is kept out of the ring (the next one)
+	bool align(vp_data& vpd, qav::frame& cur, const long long& max_pts) {
+		unsigned int	n_shown = 0;
+		while(!vpd.is_over) {
+			if (!vpd.next) {
+				vp_slot	&slot = vpd.ring.get_full();
+				if (-1 == slot.frame) {
+					// leave the slot there, the producer is gone
+					vpd.is_over = true;
+					break;
+				}
+				vpd.next = &slot;
+			}
+			if (vpd.next->buf.pts() > max_pts) break;
+			cur.swap(vpd.next->buf);
+			vpd.next = 0;
+			vpd.ring.put_free();
+			vpd.has_cur = true;
+			++n_shown;
+		}
+		if (n_shown > 1) {
+			vpd.n_skipped += n_shown - 1;
+			LOG_DEBUG << '[' << vpd.name << "] " << n_shown - 1 << " extra frame(s) skipped at " << max_pts << "us" << std::endl;
+		} else if (0 == n_shown && vpd.has_cur && !vpd.is_over) {
+			++vpd.n_repeated;
+			LOG_DEBUG << '[' << vpd.name << "] missing frame, previous one repeated at " << max_pts << "us" << std::endl;
+		}
+		// once over, the last frame isn't shown anymore
+		return vpd.has_cur && (n_shown > 0 || !vpd.is_over);
+	}
 }
 
 int main(int argc, char *argv[]) {
@@ -295,16 +411,28 @@ int main(int argc, char *argv[]) {
 		av_register_all();
 		if (settings::REF_VIDEO == "")
 			throw std::runtime_error("Reference video not specified");
+		// decoders, scalers and analyzers all run at the same time,
+		// so they share one budget of cores: by default half of them
+		// goes to the decoders, the scalers get at most one thread per
+		// video (a job is a whole picture) and the analyzers the rest
+		const int	n_cpus = mt::get_cpu_count(),
+				n_videos = 1 + (argc - param),
+				dec_threads = (settings::DECODER_THREADS > 0) ? settings::DECODER_THREADS : std::max(1, n_cpus/(2*n_videos)),
+				n_left = std::max(1, n_cpus - dec_threads*n_videos);
+		settings::SCALER_THREADS = settings::SCALE_STAGE ? std::max(1, std::min(n_videos, n_left/2)) : 1;
+		settings::STATS_THREADS = std::max(1, n_left - (settings::SCALE_STAGE ? settings::SCALER_THREADS : 0));
+		LOG_INFO << "Threads: " << dec_threads << " per decoder, " << settings::SCALER_THREADS << " scaling, " << settings::STATS_THREADS << " analyzing" << std::endl;
 		bool		glb_exit = false;
-		mt::Semaphore	sem_cons;
 		// create data for reference video
-		mt::Semaphore	ref_prod;
-		VUCHAR		ref_buf;
-		int		ref_frame;
-		qav::qvideo	ref_video(settings::REF_VIDEO.c_str(), settings::VIDEO_SIZE_W, settings::VIDEO_SIZE_H);
+		VP_RING		ref_ring(settings::FRAME_QUEUE);
+		std::auto_ptr<qav::frame_source>	p_ref_video(qav::open_source(settings::REF_VIDEO.c_str(), settings::VIDEO_SIZE_W, settings::VIDEO_SIZE_H, dec_threads));
 		// get const values
-		const qav::scr_size	ref_sz = ref_video.get_size();
-		const int		ref_fps_k = ref_video.get_fps_k();
+		const qav::scr_size	ref_sz = p_ref_video->get_size();
+		const int		ref_fps_k = p_ref_video->get_fps_k();
+		// frames are paired by timestamp: a video shows its frame
+		// till the next one is due, half a reference frame
+		// duration is the tolerance
+		const long long		ref_tol = (ref_fps_k > 0) ? 500000000LL/ref_fps_k : 0;
 		//
 		//ref_video.get_frame(ref_buf);
 		//return 0;
@@ -312,9 +440,9 @@ int main(int argc, char *argv[]) {
 		V_VPDATA	v_data;
 		for(int i = param; i < argc; ++i) {
 			try {
-				shared_ptr<vp_data>	vpd(new vp_data);
+				shared_ptr<vp_data>	vpd(new vp_data(settings::FRAME_QUEUE));
 				vpd->name = get_filename(argv[i]);
-				vpd->video = new qav::qvideo(argv[i], ref_sz.x, ref_sz.y);
+				vpd->video = qav::open_source(argv[i], ref_sz.x, ref_sz.y, dec_threads);
 				if (vpd->video->get_fps_k() != ref_fps_k) {
 					if (settings::IGNORE_FPS) {
 						LOG_WARNING << '[' << argv[i] << "] has different FPS (" << vpd->video->get_fps_k()/1000 << ')' << std::endl;
@@ -329,8 +457,9 @@ int main(int argc, char *argv[]) {
 		// print some infos
 		LOG_INFO << "Skip frames: " << ((settings::SKIP_FRAMES > 0) ? settings::SKIP_FRAMES : 0) << std::endl;
 		LOG_INFO << "Max frames: " << ((settings::MAX_FRAMES > 0) ? settings::MAX_FRAMES : 0) << std::endl;
+		LOG_INFO << "Frame queue: " << settings::FRAME_QUEUE << std::endl;
 		// create the stats analyzer (like the psnr)
-		LOG_INFO << "Analyzer set: " << settings::ANALYZER << std::endl;
+		LOG_INFO << "Analyzer set: " << settings::ANALYZER << " (" << kernels::isa() << " kernels)" << std::endl;
 		std::auto_ptr<stats::s_base>	s_analyzer(stats::get_analyzer(settings::ANALYZER.c_str(), v_data.size(), ref_sz.x, ref_sz.y, std::cout));
 		// set the default values, in case will get overwritten
 		s_analyzer->set_parameter("fpa", XtoS(ref_fps_k/1000));
@@ -340,20 +469,53 @@ int main(int argc, char *argv[]) {
 			LOG_INFO << "Analyzer parameter: " << it->first << " = " << it->second << std::endl;
 			s_analyzer->set_parameter(it->first.c_str(), it->second.c_str());
 		}
+		// decode straight to the layout the analyzer needs
+		qav::pix_layout		layout = s_analyzer->get_layout();
+		// high bit depth references keep their samples when
+		// the analyzer can take them
+		const int		ref_depth = p_ref_video->get_depth();
+		if (qav::PL_YUV420P == layout && 8 < ref_depth) {
+			if (s_analyzer->high_depth()) layout = (10 < ref_depth) ? qav::PL_YUV420P12 : qav::PL_YUV420P10;
+			else LOG_WARNING << "Reference has " << ref_depth << " bit samples, the analyzer works on 8 bits" << std::endl;
+		}
+		LOG_INFO << "Analyzer frame layout: " << qav::layout_name(layout) << std::endl;
+		// the reference may come from (or go to) the cache
+		p_ref_video.reset(qav::cache_source(p_ref_video.release(), settings::REF_VIDEO.c_str(), layout));
+		qav::frame_source			&ref_video = *p_ref_video;
+		ref_video.set_layout(layout);
+		for(V_VPDATA::iterator it = v_data.begin(); it != v_data.end(); ++it)
+			(*it)->video->set_layout(layout);
+		// every frame alive has its buffer from the pool: the ring
+		// slots, the one being analyzed and the one being scaled,
+		// for each video
+		qav::frame_pool::get().init(qav::frame::buf_size(layout, ref_sz.x, ref_sz.y), (1 + v_data.size())*(settings::FRAME_QUEUE + 2), settings::HUGE_PAGES);
+		// skip the initial frames, where possible seeking
+		// instead of decoding them
+		if (settings::SKIP_FRAMES > 0) {
+			if (!ref_video.skip_frames(settings::SKIP_FRAMES))
+				throw std::runtime_error("Reference video is shorter than the frames to skip");
+			for(V_VPDATA::iterator it = v_data.begin(); it != v_data.end(); ++it)
+				(*it)->video->skip_frames(settings::SKIP_FRAMES);
+		}
+		// then only give the frames shown at the reference sampled
+		// ones, the others are left out as early as possible
+		if (settings::SAMPLE_EVERY > 1) {
+			if (ref_fps_k <= 0)
+				throw std::runtime_error("Reference video has no frame rate, can't sample it");
+			LOG_INFO << "Sample every: " << settings::SAMPLE_EVERY << " frames" << std::endl;
+			ref_video.set_sampling(settings::SAMPLE_EVERY*1000000000LL, ref_fps_k, ref_tol);
+			for(V_VPDATA::iterator it = v_data.begin(); it != v_data.end(); ++it)
+				(*it)->video->set_sampling(settings::SAMPLE_EVERY*1000000000LL, ref_fps_k, ref_tol);
+		}
 		// create all the threads
-		// this varibale holds a bool to say if we have to skip
-		// or not the next frame to extract, first frame is 1
-		bool skip_next_frame = producers_utils::is_frame_skip(1);
-		video_producer	ref_vpth(ref_frame, ref_prod, sem_cons, ref_buf, ref_video, glb_exit, skip_next_frame);
+		video_producer	ref_vpth(ref_ring, ref_video, glb_exit);
 		V_VPTH		v_th;
 		for(V_VPDATA::iterator it = v_data.begin(); it != v_data.end(); ++it)
-			v_th.push_back(new video_producer((*it)->frame, (*it)->prod, sem_cons, (*it)->buf, *((*it)->video), glb_exit, skip_next_frame));
+			v_th.push_back(new video_producer((*it)->ring, *((*it)->video), glb_exit));
 		// we'll need some tmp buffers
-		VUCHAR			t_ref_buf;
-		std::vector<VUCHAR>	t_bufs(v_data.size());
+		qav::frame		t_ref_buf;
+		stats::V_FRAME		t_bufs(v_data.size());
 		// and now the core algorithm
-		// init all the semaphores
-		producers_utils::lock(sem_cons, ref_prod, v_data);
 		// start the threads
 		producers_utils::start(ref_vpth, v_th);
 		// print header, this has to be moved in the analyzer
@@ -389,53 +551,39 @@ int main(int argc, char *argv[]) {
 		size_t index = 0;
 		for(V_VPDATA::const_iterator it = v_data.begin(); it != v_data.end(); ++it, ++index)
 		{
-			std::cout << "var d" << index <<  " = [];" << std::endl;
+			for(int s = 0; s < s_analyzer->n_series(); ++s)
+				std::cout << "var " << s_analyzer->series_var(index, s) <<  " = [];" << std::endl;
 		}
 
 		index = 0;
 		std::cout << "data = [" << std::endl;
 		for(V_VPDATA::const_iterator it = v_data.begin(); it != v_data.end(); ++it, ++index)
 		{
-			std::cout << "{ data : d" << index << ", label :\"" << (*it)->name << "\"}," << std::endl;
+			for(int s = 0; s < s_analyzer->n_series(); ++s)
+				std::cout << "{ data : " << s_analyzer->series_var(index, s) << ", label :\"" << (*it)->name << s_analyzer->series_name(s) << "\"}," << std::endl;
 		}
 		std::cout << "];" << std::endl;
 
 		while(!glb_exit) {
-			// wait for the consumer to be signalled 1 + n times
-			const static int CONS_SIG_NUM = 1 + v_th.size();
-			producers_utils::sync(sem_cons, CONS_SIG_NUM);
-			// now check everything is ok
-			const int	cur_ref_frame = ref_frame;
-			if (-1 == cur_ref_frame) {
-				glb_exit = true;
-				// allow the producers to run
-				producers_utils::unlock(ref_prod, v_data);
-				continue;
-			}
-			skip_next_frame = producers_utils::is_frame_skip(cur_ref_frame+1);
+			// wait for the next reference frame
+			vp_slot		&ref_slot = ref_ring.get_full();
+			const int	cur_ref_frame = ref_slot.frame;
 			// set if we have to exit
-			glb_exit = producers_utils::is_last_frame(cur_ref_frame);
-			// in case we have to skip frames or exit...
-			if (skip_next_frame || glb_exit) {
-				// allow the producers to run
-				producers_utils::unlock(ref_prod, v_data);
+			if (-1 == cur_ref_frame || producers_utils::is_last_frame(cur_ref_frame)) {
+				glb_exit = true;
 				continue;
 			}
-			// vector of bool telling if everything is ok
+			t_ref_buf.swap(ref_slot.buf);
+			ref_ring.put_free();
+			// then the frame every video shows at the same time
 			std::vector<bool> v_ok;
-			for(V_VPDATA::const_iterator it = v_data.begin(); it != v_data.end(); ++it)
-				if ((*it)->frame == cur_ref_frame) v_ok.push_back(true);
-				else v_ok.push_back(false);
-			// then swap the vectors
-			t_ref_buf.swap(ref_buf);
 			for(size_t i = 0; i < v_data.size(); ++i)
-				t_bufs[i].swap(v_data[i]->buf);
-			// allow the producers to run
-			producers_utils::unlock(ref_prod, v_data);
+				v_ok.push_back(producers_utils::align(*v_data[i], t_bufs[i], t_ref_buf.pts() + ref_tol));
 			// finally process data
-			if(!producers_utils::is_frame_skip(cur_ref_frame))
-				s_analyzer->process(cur_ref_frame, t_ref_buf, v_ok, t_bufs);
+			s_analyzer->process(cur_ref_frame, t_ref_buf, v_ok, t_bufs);
 		}
+		// let the producers waiting on a full ring quit
+		producers_utils::unblock(ref_ring, v_data);
 
 
 		std::cout << "        var" << std::endl;
@@ -468,6 +616,12 @@ int main(int argc, char *argv[]) {
 
 		// wait for all threads
 		producers_utils::stop(ref_vpth, v_th);
+		for(V_VPDATA::const_iterator it = v_data.begin(); it != v_data.end(); ++it)
+			if ((*it)->n_skipped || (*it)->n_repeated)
+				LOG_WARNING << '[' << (*it)->name << "] not in sync with the reference: " << (*it)->n_skipped << " extra frame(s) skipped, "
+					<< (*it)->n_repeated << " missing frame(s) repeated" << std::endl;
+		LOG_INFO << "Frame pool: " << qav::frame_pool::get().n_bufs() << " buffers of " << qav::frame_pool::get().buf_size()
+			<< " bytes, high water mark " << qav::frame_pool::get().high_water() << std::endl;
 	} catch(std::exception& e) {
 		LOG_ERROR << e.what() << std::endl;
 	} catch(...) {
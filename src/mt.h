@@ -22,14 +22,34 @@
 
 #include <pthread.h>
 #include <semaphore.h>
-#include <list>
+#include <deque>
 #include <vector>
 #include <errno.h>
 #include <exception>
 #include <string>
+#include <fstream>
+#include <set>
+#include <algorithm>
 
 namespace mt {
 
+	// number of processors as listed in /proc/cpuinfo
+	inline unsigned int get_cpu_count(void) {
+		std::ifstream		cpuinfo("/proc/cpuinfo");
+		std::string		line;
+		std::set<std::string>	IDs;
+		while (cpuinfo){
+			std::getline(cpuinfo,line);
+			if (line.empty())
+				continue;
+			if (line.find("processor") != 0)
+				continue;
+			IDs.insert(line);
+		}
+		if (IDs.empty()) return 1;
+		return IDs.size();
+	}
+
 	class mt_exception : public std::exception {
 		const std::string	_what;
 	public:
@@ -50,8 +70,8 @@ namespace mt {
 		Semaphore(const Semaphore&);
 		Semaphore& operator=(const Semaphore&);
 	public:
-		Semaphore() {
-			if (0 != sem_init(&_sem, 0, 1))
+		Semaphore(const unsigned int& value = 1) {
+			if (0 != sem_init(&_sem, 0, value))
 				throw mt_exception("Semaphore: Semaphore()");
 		}
 
@@ -153,142 +173,503 @@ namespace mt {
 		}
 	};
 
-	class ThreadPool {
+	// Single producer, single consumer ring of slots. The producer
+	// fills free slots in place, the consumer reads them in the same
+	// order and gives them back once done, so at most n elements
+	// are ever alive
+	template<typename T>
+	class Ring {
+		std::vector<T>	_slots;
+		Semaphore	_free,
+				_full;
+		unsigned int	_w,
+				_r;
+
+		Ring(const Ring&);
+		Ring& operator=(const Ring&);
+	public:
+		Ring(const unsigned int& n) : _slots(n), _free(n), _full(0), _w(0), _r(0) {
+			if (0 == n)
+				throw mt_exception("Ring: invalid number of slots");
+		}
+
+		// producer side: wait for a slot to fill...
+		T& get_free(void) {
+			_free.push();
+			return _slots[_w];
+		}
+
+		// ...and hand it to the consumer
+		void put_full(void) {
+			_w = (_w + 1) % _slots.size();
+			_full.pop();
+		}
+
+		// consumer side: wait for the next filled slot...
+		T& get_full(void) {
+			_full.push();
+			return _slots[_r];
+		}
+
+		// ...and give it back to the producer
+		void put_free(void) {
+			_r = (_r + 1) % _slots.size();
+			_free.pop();
+		}
+
+		// let a producer waiting on get_free go, ie. to quit
+		void unblock(void) {
+			_free.pop();
+		}
+	};
+
+	// pause in spin loops, the sibling hyperthread gets the core
+	inline void cpu_relax(void) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	// Counting latch: count_down takes the count to zero once, then
+	// wait returns. Waiters spin for a while before sleeping, as the
+	// count usually gets there within microseconds. The latch can be
+	// destroyed as soon as wait has returned
+	class Latch {
+		enum { SPIN = 4096 };
+
+		volatile long	_count;
+		volatile bool	_released,
+				_failed;
+		std::string	_error;
+		pthread_mutex_t	_mtx;
+		pthread_cond_t	_cond;
+
+		Latch(const Latch&);
+		Latch& operator=(const Latch&);
 	public:
-		class Job {
-			friend	class	ThreadPool;
-			Semaphore	_sem;
-			volatile bool	_on_hold;
-			const bool	_to_be_deleted;
-		public:
-			Job(const bool& to_be_deleted = false) : _on_hold(true), _to_be_deleted(to_be_deleted) {
-				_sem.push();
+		Latch(const long& count) : _count(count), _released(0 == count), _failed(false) {
+			if (0 != pthread_mutex_init(&_mtx, NULL))
+				throw mt_exception("Latch: Latch()");
+			if (0 != pthread_cond_init(&_cond, NULL)) {
+				pthread_mutex_destroy(&_mtx);
+				throw mt_exception("Latch: Latch()");
 			}
+		}
 
-			virtual void run(void) = 0;
-
-			/* Just rememeber that
-			- void wait(void)
-			- bool is_running(void)
-			   can only be used when the ownership of the
-			   ThreadPool::Job instance is external (eg.
-			   to_be_deleted = false).
-			   Otherwise this will lead to a crash!
-			*/
-
-			// We pop the semaphore again in case someone else
-			// will ask to wait again...
-			void wait(void) {
-				_sem.push();
-				_sem.pop();
-			};
-
-			bool is_running(void) {
-				if (_on_hold) return false;
-				if (false == _sem.trypush())
-					return true;
-				_sem.pop();
-				return false;
+		void count_down(const long& n = 1) {
+			if (0 != __sync_sub_and_fetch(&_count, n))
+				return;
+			pthread_mutex_lock(&_mtx);
+			_released = true;
+			pthread_cond_broadcast(&_cond);
+			pthread_mutex_unlock(&_mtx);
+		}
+
+		bool reached(void) const {
+			return 0 == _count;
+		}
+
+		// keeps the first error, to be called before the matching
+		// count_down
+		void fail(const std::string& what) {
+			pthread_mutex_lock(&_mtx);
+			if (!_failed) {
+				_failed = true;
+				_error = what;
 			}
+			pthread_mutex_unlock(&_mtx);
+		}
+
+		// after wait, throws the first error if any
+		void rethrow(void) const {
+			if (_failed)
+				throw mt_exception(_error);
+		}
 
-			virtual ~Job() {
+		void wait(void) {
+			for(int i = 0; i < SPIN && !reached(); ++i)
+				cpu_relax();
+			// the last count_down may still be on its way out
+			pthread_mutex_lock(&_mtx);
+			while(!_released)
+				pthread_cond_wait(&_cond, &_mtx);
+			pthread_mutex_unlock(&_mtx);
+		}
+
+		~Latch() {
+			pthread_cond_destroy(&_cond);
+			pthread_mutex_destroy(&_mtx);
+		}
+	};
+
+	// a piece of work for the TaskPool
+	class Task {
+	public:
+		virtual void run(void) = 0;
+
+		virtual ~Task() {
+		}
+	};
+
+	// Chase-Lev deque of a fixed size: the owner thread pushes and
+	// pops at the bottom, any other thread steals from the top. No
+	// locks, the only contended operation is the CAS on top when the
+	// owner and the thieves go for the same (last) task
+	class WorkDeque {
+		enum { SIZE = 1024 };
+
+		Task * volatile	_tasks[SIZE];
+		volatile long	_top,
+				_bottom;
+
+		WorkDeque(const WorkDeque&);
+		WorkDeque& operator=(const WorkDeque&);
+	public:
+		WorkDeque() : _top(0), _bottom(0) {
+		}
+
+		// owner only, false when full
+		bool push(Task *task) {
+			const long	b = _bottom;
+			if (b - _top >= SIZE) return false;
+			_tasks[b & (SIZE - 1)] = task;
+			__sync_synchronize();
+			_bottom = b + 1;
+			return true;
+		}
+
+		// owner only, last pushed first
+		Task* pop(void) {
+			const long	b = _bottom - 1;
+			_bottom = b;
+			__sync_synchronize();
+			const long	t = _top;
+			if (t > b) {
+				_bottom = b + 1;
+				return 0;
+			}
+			Task	*task = _tasks[b & (SIZE - 1)];
+			if (t == b) {
+				if (!__sync_bool_compare_and_swap(&_top, t, t + 1)) task = 0;
+				_bottom = b + 1;
 			}
+			return task;
+		}
+
+		// any thread, first pushed first; 0 when empty or when
+		// someone else got it first
+		Task* steal(void) {
+			const long	t = _top;
+			__sync_synchronize();
+			const long	b = _bottom;
+			if (t >= b) return 0;
+			Task	*task = _tasks[t & (SIZE - 1)];
+			if (!__sync_bool_compare_and_swap(&_top, t, t + 1)) return 0;
+			return task;
+		}
+
+		bool empty(void) const {
+			return _bottom <= _top;
+		}
+	};
+
+	// Work stealing pool: every worker has its own WorkDeque, tasks
+	// spawned by a worker go on its deque and idle workers steal them.
+	// Tasks from other threads go through a locked queue, parallel_for
+	// puts a single task there per call and the workers split it.
+	// Idle workers spin on the deques for a while, then sleep till
+	// something is spawned. Threads waiting on the pool (wait) run
+	// tasks meanwhile, so tasks can wait on nested work too
+	class TaskPool {
+		enum { SPIN = 256 };
+
+		struct Worker {
+			TaskPool	*pool;
+			unsigned int	idx,
+					seed;
+			WorkDeque	deque;
+			pthread_t	th;
 		};
-	private:
-		Mutex		_list_mtx;
-		Semaphore	_list_sem;
-		std::list<Job*>	_list_jobs;
-
-		// the following variable is not mutex
-		// protected because is sort of write-only
-		// by main ThreadPool thread, see destructor
-		volatile bool		_tp_quit;
-		const unsigned int	_n_execs;
-		std::vector<pthread_t>	_th_ids;
-
-		bool get_job(Job** _job) {
-			ScopedLock _sl(_list_mtx);
-			if (!_list_jobs.empty()) {
-				*_job = _list_jobs.front();
-				_list_jobs.pop_front();
-				return true;
+
+		std::vector<Worker*>	_workers;
+		pthread_key_t		_key;
+		Mutex			_inj_mtx;
+		std::deque<Task*>	_inj;
+		volatile long		_n_inj,
+					_n_parked;
+		volatile unsigned long	_epoch;
+		pthread_mutex_t		_park_mtx;
+		pthread_cond_t		_park_cond;
+		volatile bool		_quit;
+
+		// the worker of this pool running on this thread, if any
+		Worker* current(void) const {
+			return (Worker*)pthread_getspecific(_key);
+		}
+
+		Task* get_injected(void) {
+			if (0 == _n_inj) return 0;
+			ScopedLock	_sl(_inj_mtx);
+			if (_inj.empty()) return 0;
+			Task	*task = _inj.front();
+			_inj.pop_front();
+			__sync_sub_and_fetch(&_n_inj, 1);
+			return task;
+		}
+
+		// own deque first, then the shared queue, then the others
+		// starting from a random one
+		Task* find_task(Worker *w) {
+			Task	*task = w ? w->deque.pop() : 0;
+			if (task) return task;
+			if (0 != (task = get_injected())) return task;
+			const unsigned int	n = _workers.size();
+			unsigned int		v = 0;
+			if (w) {
+				w->seed = w->seed*1103515245 + 12345;
+				v = (w->seed >> 16) % n;
 			}
+			for(unsigned int i = 0; i < n; ++i, v = (v + 1) % n)
+				if (_workers[v] != w && 0 != (task = _workers[v]->deque.steal()))
+					return task;
+			return 0;
+		}
+
+		bool has_work(void) const {
+			if (0 != _n_inj) return true;
+			for(unsigned int i = 0; i < _workers.size(); ++i)
+				if (!_workers[i]->deque.empty()) return true;
 			return false;
 		}
 
-		// Technically we should declare it as extern "C" but we
-		// don't care as seen as the function pointer will correspond
-		// to a proper C-like function even if the name will be C++ like
-		static void* job_exec(void* par) throw() {
+		// a parked worker is woken by the next spawn: either the
+		// spawner sees it parked or the worker sees the task
+		void park(void) {
+			pthread_mutex_lock(&_park_mtx);
+			const unsigned long	epoch = _epoch;
+			__sync_add_and_fetch(&_n_parked, 1);
+			if (!has_work())
+				while(epoch == _epoch && !_quit)
+					pthread_cond_wait(&_park_cond, &_park_mtx);
+			__sync_sub_and_fetch(&_n_parked, 1);
+			pthread_mutex_unlock(&_park_mtx);
+		}
+
+		void wake(void) {
+			__sync_synchronize();
+			if (0 == _n_parked) return;
+			pthread_mutex_lock(&_park_mtx);
+			++_epoch;
+			pthread_cond_signal(&_park_cond);
+			pthread_mutex_unlock(&_park_mtx);
+		}
+
+		static void* worker_exec(void* par) throw() {
+			Worker		*w = (Worker*)par;
+			TaskPool	*p = w->pool;
+			pthread_setspecific(p->_key, w);
+			while(!p->_quit) {
+				Task	*task = 0;
+				for(int i = 0; i < SPIN && !task && !p->_quit; ++i)
+					if (0 == (task = p->find_task(w))) cpu_relax();
+				if (task) task->run();
+				else if (!p->_quit) p->park();
+			}
+			return 0;
+		}
+
+		// lets the first n_started workers go and frees everything,
+		// for the destructor and for a constructor that failed
+		void stop(const unsigned int& n_started) {
+			pthread_mutex_lock(&_park_mtx);
+			_quit = true;
+			pthread_cond_broadcast(&_park_cond);
+			pthread_mutex_unlock(&_park_mtx);
+			for(unsigned int i = 0; i < n_started; ++i)
+				pthread_join(_workers[i]->th, NULL);
+			for(unsigned int i = 0; i < _workers.size(); ++i)
+				delete _workers[i];
+			_workers.clear();
+			pthread_cond_destroy(&_park_cond);
+			pthread_mutex_destroy(&_park_mtx);
+			pthread_key_delete(_key);
+		}
+
+		TaskPool(const TaskPool&);
+		TaskPool& operator=(const TaskPool&);
+	public:
+		TaskPool(const unsigned int& n_execs) : _n_inj(0), _n_parked(0), _epoch(0), _quit(false) {
+			if (n_execs == 0 || n_execs > 256)
+				throw mt_exception("TaskPool: invalid number of n_execs");
+			if (0 != pthread_key_create(&_key, NULL))
+				throw mt_exception("TaskPool: TaskPool()");
+			if (0 != pthread_mutex_init(&_park_mtx, NULL)) {
+				pthread_key_delete(_key);
+				throw mt_exception("TaskPool: TaskPool()");
+			}
+			if (0 != pthread_cond_init(&_park_cond, NULL)) {
+				pthread_mutex_destroy(&_park_mtx);
+				pthread_key_delete(_key);
+				throw mt_exception("TaskPool: TaskPool()");
+			}
+			// all the deques exist before any worker can steal
 			try {
-				ThreadPool *p = (ThreadPool*)par;
-				while(true) {
-					// first push on the semaphore
-					p->_list_sem.push();
-					// check if we have to quit
-					if (p->_tp_quit) return 0;
-					// get an element to process
-					Job	*curJob = 0;
-					if (p->get_job(&curJob)) {
-						// we need to save the delete_job varibale because
-						// after the semaphore has been popped the object 
-						// could not exist anymore
-						const bool delete_job = curJob->_to_be_deleted;
-						try {
-							curJob->_on_hold = false;
-							curJob->run();
-						} catch(...) {
-						}
-						// if the following instruction throws is better 
-						// to let the user know because this means that
-						// the semaphore is not valid anymore...this should
-						// never happen...
-						curJob->_sem.pop();
-						// if it has to be deleted do it!
-						if (delete_job) delete curJob;
-					}
-					// check if we have to quit
-					if (p->_tp_quit) return 0;
+				_workers.reserve(n_execs);
+				for(unsigned int i = 0; i < n_execs; ++i) {
+					_workers.push_back(new Worker);
+					_workers[i]->pool = this;
+					_workers[i]->idx = i;
+					_workers[i]->seed = i + 1;
 				}
 			} catch(...) {
+				stop(0);
+				throw;
 			}
-			return 0;
+			for(unsigned int i = 0; i < n_execs; ++i)
+				if (0 != pthread_create(&_workers[i]->th, NULL, &worker_exec, _workers[i])) {
+					stop(i);
+					throw mt_exception("TaskPool: could not start all specified n_execs");
+				}
+		}
+
+		unsigned int n_execs(void) const {
+			return _workers.size();
+		}
+
+		// the pool doesn't own the task, it has to outlive its run
+		void spawn(Task *task) {
+			Worker	*w = current();
+			if (w && w->pool == this) {
+				if (!w->deque.push(task)) {
+					task->run();
+					return;
+				}
+			} else {
+				ScopedLock	_sl(_inj_mtx);
+				_inj.push_back(task);
+				__sync_add_and_fetch(&_n_inj, 1);
+			}
+			wake();
+		}
+
+		// run tasks till latch is reached, then wait for it
+		void wait(Latch& latch) {
+			Worker	*w = current();
+			if (w && w->pool != this) w = 0;
+			for(int spin = 0; !latch.reached() && spin < SPIN; ) {
+				Task	*task = find_task(w);
+				if (task) {
+					task->run();
+					spin = 0;
+				} else {
+					cpu_relax();
+					++spin;
+				}
+			}
+			latch.wait();
+		}
+
+		~TaskPool() {
+			stop(_workers.size());
 		}
+	};
 
-		ThreadPool(const ThreadPool&);
-		ThreadPool& operator=(const ThreadPool&);
+	// body(b, e) on [begin, end) split in ranges of grain or less,
+	// returns when they're all done. The range is halved by the
+	// workers as they take it, the halves get stolen by idle ones
+	template<typename F>
+	class RangeTask : public Task {
+		TaskPool	&_pool;
+		F		&_body;
+		size_t		_b,
+				_e;
+		const size_t	_grain;
+		Latch		&_latch;
 	public:
-		// Just take into account that semaphores are not syscall immune
-		// so when you run in debug mode you can have exceptions thrown on
-		// push because of system interrruption! Don't get scared!
-		ThreadPool(const unsigned int& n_execs) : _tp_quit(false), _n_execs(n_execs), _th_ids(n_execs) {
-			if (_n_execs == 0 || _n_execs > 256)
-				throw mt_exception("ThreadPool: invalid number of n_execs");
-			// create the job_exec threads
-			for (unsigned int i = 0; i < _n_execs; ++i)
-				if (0 != pthread_create(&_th_ids[i], NULL, &job_exec, this)) {
-					for (unsigned int j=0; j < i; ++j)
-						pthread_cancel(_th_ids[j]);
-					throw mt_exception("ThreadPool: could not start all specified n_execs");
+		RangeTask(TaskPool& pool, F& body, const size_t& b, const size_t& e, const size_t& grain, Latch& latch) :
+		_pool(pool), _body(body), _b(b), _e(e), _grain(grain), _latch(latch) {
+		}
+
+		// an exception goes into the latch and the rest of the
+		// range is counted down anyway, so parallel_for returns
+		virtual void run(void) {
+			try {
+				while(_e - _b > _grain) {
+					const size_t	m = _b + (_e - _b)/2;
+					RangeTask	*half = new RangeTask(_pool, _body, m, _e, _grain, _latch);
+					try {
+						_pool.spawn(half);
+					} catch(...) {
+						delete half;
+						throw;
+					}
+					_e = m;
 				}
+				_body(_b, _e);
+			} catch(std::exception& e) {
+				_latch.fail(e.what());
+			} catch(...) {
+				_latch.fail("RangeTask: unknown exception");
+			}
+			// the latch may go as soon as it's counted down
+			const long	n = _e - _b;
+			Latch		&latch = _latch;
+			delete this;
+			latch.count_down(n);
+		}
+	};
+
+	// the first exception thrown by body is rethrown as an
+	// mt_exception once the whole range is done
+	template<typename F>
+	void parallel_for(TaskPool& pool, const size_t& begin, const size_t& end, const size_t& grain, F& body) {
+		if (begin >= end) return;
+		Latch		latch(end - begin);
+		RangeTask<F>	*task = new RangeTask<F>(pool, body, begin, end, std::max((size_t)1, grain), latch);
+		try {
+			pool.spawn(task);
+		} catch(...) {
+			delete task;
+			throw;
+		}
+		pool.wait(latch);
+		latch.rethrow();
+	}
+
+	// Tasks run together: add them, then wait starts them all and
+	// returns once they're done, throwing the first exception of
+	// any of them. Tasks aren't owned by the group
+	class TaskGroup {
+		TaskPool		&_pool;
+		std::vector<Task*>	_tasks;
+
+		struct run_tasks {
+			std::vector<Task*>	&tasks;
+
+			run_tasks(std::vector<Task*>& t) : tasks(t) {
+			}
+
+			void operator()(const size_t& b, const size_t& e) {
+				for(size_t i = b; i < e; ++i)
+					tasks[i]->run();
+			}
+		};
+
+		TaskGroup(const TaskGroup&);
+		TaskGroup& operator=(const TaskGroup&);
+	public:
+		TaskGroup(TaskPool& pool) : _pool(pool) {
 		}
 
-		void add(Job* job) {
-			ScopedLock _sl(_list_mtx);
-			_list_jobs.push_back(job);
-			_list_sem.pop();
+		void add(Task *task) {
+			_tasks.push_back(task);
 		}
 
-		~ThreadPool() {
-			_tp_quit = true;
-			for (unsigned int i = 0; i < _n_execs; ++i)
-				_list_sem.pop();
-			for (unsigned int i = 0; i < _n_execs; ++i)
-				pthread_join(_th_ids[i], NULL);
-			// potentialy unsafe...this could throw...but should never...
-			ScopedLock _sl(_list_mtx);
-			for (std::list<Job*>::iterator it = _list_jobs.begin(); it != _list_jobs.end(); ++it)
-				if ((*it)->_to_be_deleted) delete *it;
+		void wait(void) {
+			std::vector<Task*>	tasks;
+			tasks.swap(_tasks);
+			run_tasks		body(tasks);
+			parallel_for(_pool, 0, tasks.size(), 1, body);
 		}
 	};
 }
@@ -18,12 +18,48 @@
 */
 
 #include "qav.h"
+#include "qraw.h"
 #include "settings.h"
 #include <stdexcept>
 #include <sstream>
+#include <vector>
+#include <cstring>
 
-qav::qvideo::qvideo(const char* file, int _out_width, int _out_height) : frnum(0), videoStream(-1), out_width(_out_width),
-out_height(_out_height), pFormatCtx(NULL), pCodecCtx(NULL), pCodec(NULL), pFrame(NULL), img_convert_ctx(NULL) {
+// with refcounted frames the decoder planes can be handed over
+// to the analyzers without copying them
+#if LIBAVCODEC_VERSION_MAJOR >= 55
+#define QAV_REFCOUNTED_FRAMES
+#endif
+
+namespace {
+#ifdef QAV_REFCOUNTED_FRAMES
+	void free_avframe(void *p) {
+		AVFrame	*f = (AVFrame*)p;
+		av_frame_free(&f);
+	}
+#endif
+
+	// frame numbers can be told from timestamps only at a constant frame
+	// rate: the average rate is the base one and, when the container
+	// says so, the frames fill the whole duration
+	bool is_cfr(const AVStream *st) {
+		if (!st->r_frame_rate.num || !st->r_frame_rate.den || !st->avg_frame_rate.num || !st->avg_frame_rate.den)
+			return false;
+		if (0 != av_cmp_q(st->r_frame_rate, st->avg_frame_rate))
+			return false;
+		if (0 < st->nb_frames && AV_NOPTS_VALUE != st->duration && 0 < st->duration) {
+			const AVRational	frame_tb = { st->r_frame_rate.den, st->r_frame_rate.num };
+			const int64_t		n_frames = av_rescale_q(st->duration, st->time_base, frame_tb);
+			if (n_frames > st->nb_frames + 1 || n_frames < st->nb_frames - 1)
+				return false;
+		}
+		return true;
+	}
+}
+
+qav::qvideo::qvideo(const char* file, int _out_width, int _out_height, int n_threads) : frnum(0), videoStream(-1), out_width(_out_width),
+out_height(_out_height), pFormatCtx(NULL), pCodecCtx(NULL), pCodec(NULL), pFrame(NULL), conv(NULL), out_layout(PL_RGB24), is_direct(false), is_staged(false), is_flushing(false), is_pending(false),
+staged_frnum(0), staged_pts(0) {
 	const char* pslash = strrchr(file, '/');
 	if (pslash)
 		fname = pslash+1;
@@ -59,12 +95,26 @@ out_height(_out_height), pFormatCtx(NULL), pCodecCtx(NULL), pCodec(NULL), pFrame
 		free_resources();
 		throw std::runtime_error("Can't find codec for video stream");
 	}
+#ifdef QAV_REFCOUNTED_FRAMES
+	pCodecCtx->refcounted_frames = 1;
+#endif
+	// let the decoder spread frames and slices over more
+	// cores, it will use what the codec supports
+	if (n_threads > 1) {
+		pCodecCtx->thread_count = n_threads;
+		pCodecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	}
 	if(avcodec_open2(pCodecCtx, pCodec, NULL)<0) {
 		free_resources();
 		throw std::runtime_error("Can't open codec for video stream");
 	}
+	LOG_INFO << "Decoder threads for (" << file << "): " << pCodecCtx->thread_count << std::endl;
 	// alloacate data to extract frames
+#ifdef QAV_REFCOUNTED_FRAMES
+	pFrame = av_frame_alloc();
+#else
 	pFrame = avcodec_alloc_frame();
+#endif
 	if (!pFrame) {
 		free_resources();
 		throw std::runtime_error("Can't allocated frame for video stream");
@@ -84,11 +134,34 @@ out_height(_out_height), pFormatCtx(NULL), pCodecCtx(NULL), pCodec(NULL), pFrame
 	if (out_width!=pCodecCtx->width || out_height!=pCodecCtx->height)
 		LOG_WARNING << "Video (" << file <<") will get scaled: " << pCodecCtx->width << 'x' << pCodecCtx->height << " (in), " << out_width << 'x' << out_height << " (out)" << std::endl;
 
-	img_convert_ctx = sws_getContext(pCodecCtx->width, pCodecCtx->height, pCodecCtx->pix_fmt, out_width, out_height, PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
-	if (!img_convert_ctx) {
+	try {
+		set_layout(PL_RGB24);
+	} catch(...) {
 		free_resources();
-		throw std::runtime_error("Can't allocated sw_scale context");
+		throw;
+	}
+}
+
+void qav::qvideo::set_layout(const pix_layout& layout) {
+	delete conv;
+	conv = 0;
+	out_layout = layout;
+	// when the decoder already gives us what we need
+	// don't go through sw_scale at all
+	is_direct = (scaler::fmt(out_layout) == pCodecCtx->pix_fmt
+			&& out_width == pCodecCtx->width && out_height == pCodecCtx->height);
+	if (is_direct) {
+		LOG_INFO << "Video (" << fname << ") frames are used as decoded (no conversion)" << std::endl;
+		return;
 	}
+	conv = new scaler(pCodecCtx->width, pCodecCtx->height, pCodecCtx->pix_fmt, out_width, out_height, out_layout);
+#ifdef QAV_REFCOUNTED_FRAMES
+	is_staged = settings::SCALE_STAGE;
+#else
+	// the decoder reuses its buffers, the picture has to be
+	// converted before decoding the next one
+	is_staged = false;
+#endif
 }
 
 qav::scr_size qav::qvideo::get_size(void) const {
@@ -101,38 +174,233 @@ int qav::qvideo::get_fps_k(void) const {
 	return 0;
 }
 
-bool qav::qvideo::get_frame(std::vector<unsigned char>& out, int *_frnum, const bool skip) {
-	out.resize(avpicture_get_size(PIX_FMT_RGB24, out_width, out_height));
+int qav::qvideo::get_depth(void) const {
+	return scaler::depth(pCodecCtx->pix_fmt);
+}
+
+void qav::qvideo::fill_direct(frame& out) {
+#ifdef QAV_REFCOUNTED_FRAMES
+	// move the reference out, the decoder won't touch
+	// these planes anymore and we don't copy them
+	AVFrame	*ref = av_frame_alloc();
+	if (!ref)
+		throw std::runtime_error("Can't allocate frame reference");
+	av_frame_move_ref(ref, pFrame);
+	out.set_ref(out_layout, out_width, out_height, ref->data, ref->linesize, ref, free_avframe);
+#else
+	// decoder is going to reuse its buffers, copy the planes
+	out.alloc(out_layout, out_width, out_height);
+	for(int i = 0; i < out.n_planes(); ++i)
+		for(int j = 0; j < out.plane_height(i); ++j)
+			memcpy(out.data(i) + j*out.linesize(i), pFrame->data[i] + j*pFrame->linesize[i], out.plane_width(i));
+#endif
+}
+
+bool qav::qvideo::decode_frame(void) {
 	AVPacket	packet;
-	bool		is_read = false;
+	int		frameFinished = 0;
 	av_init_packet(&packet);
-	while (av_read_frame(pFormatCtx, &packet)>=0) {
+	while (!is_flushing && av_read_frame(pFormatCtx, &packet)>=0) {
 		if (packet.stream_index==videoStream) {
-			int frameFinished = 0;
 			// Decode video frame
-			if(0 > avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet))
+			set_discard(packet);
+			const int rc = avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
+			av_free_packet(&packet);
+			if (0 > rc)
 				return false;
-			if(frameFinished) {
-				++frnum;
-				if (_frnum) *_frnum = frnum;
-				is_read=true;
-				if (!skip) {
-					AVPicture picRGB;
-					// Assign appropriate parts of buffer to image planes in pFrameRGB
-					avpicture_fill((AVPicture*)&picRGB, (unsigned char*)&out[0], PIX_FMT_RGB24, out_width, out_height);
-							// Convert the image from its native format to RGB
-						sws_scale(img_convert_ctx, pFrame->data, pFrame->linesize, 0, pCodecCtx->height, picRGB.data, picRGB.linesize);
-					if (settings::SAVE_IMAGES)
-						save_frame(&out[0]);
+			if (frameFinished)
+				return true;
+		} else av_free_packet(&packet);
+	}
+	// end of file, drain the frames still in the decoder
+	// (one per call, with an empty packet)
+	is_flushing = true;
+	av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	if (0 > avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet))
+		return false;
+	return 0 != frameFinished;
+}
+
+long long qav::qvideo::frame_duration(void) const {
+	const int	fps_k = get_fps_k();
+	return (fps_k > 0) ? 1000000000LL/fps_k : 0;
+}
+
+void qav::qvideo::set_discard(const AVPacket& packet) {
+	if (smp_num <= 0) return;
+	// frames no one refers to can be left out when they won't be
+	// sampled, the others have to be decoded anyway
+	const AVStream	*st = pFormatCtx->streams[videoStream];
+	bool		is_needed = true;
+	if (AV_NOPTS_VALUE != packet.pts) {
+		const int64_t		start = (AV_NOPTS_VALUE != st->start_time) ? st->start_time : 0;
+		const AVRational	us_tb = { 1, 1000000 };
+		is_needed = is_sampled(av_rescale_q(packet.pts - start, st->time_base, us_tb), frame_duration());
+	}
+	pCodecCtx->skip_frame = is_needed ? AVDISCARD_DEFAULT : AVDISCARD_NONREF;
+}
+
+long long qav::qvideo::frame_pts(void) const {
+	const AVStream	*st = pFormatCtx->streams[videoStream];
+	const int64_t	pts = pFrame->best_effort_timestamp;
+	if (AV_NOPTS_VALUE != pts) {
+		const int64_t		start = (AV_NOPTS_VALUE != st->start_time) ? st->start_time : 0;
+		const AVRational	us_tb = { 1, 1000000 };
+		return av_rescale_q(pts - start, st->time_base, us_tb);
+	}
+	// no timestamps, assume a constant frame rate
+	const int	fps_k = get_fps_k();
+	return (fps_k > 0) ? (frnum - 1)*1000000000LL/fps_k : 0;
+}
+
+void qav::qvideo::stage_frame(void) {
+#ifdef QAV_REFCOUNTED_FRAMES
+	staged_pts = frame_pts();
+	// the scaling job keeps the decoded planes till it's done
+	AVFrame	*ref = av_frame_alloc();
+	if (!ref)
+		throw std::runtime_error("Can't allocate frame reference");
+	av_frame_move_ref(ref, pFrame);
+	staged_frnum = frnum;
+	conv->start(ref->data, ref->linesize, ref, free_avframe);
+#endif
+}
+
+bool qav::qvideo::get_frame(frame& out, int *_frnum, const bool skip) {
+	while(true) {
+		// a seek could have left a frame for us
+		bool	got = true;
+		if (is_pending) is_pending = false;
+		else got = decode_frame();
+		if (got) {
+			++frnum;
+			if (smp_num > 0 && !skip) {
+				// discarded frames aren't counted, the frame
+				// number comes from the timestamp
+				const long long	pts = frame_pts(),
+						dur = frame_duration();
+				if (AV_NOPTS_VALUE != pFrame->best_effort_timestamp && dur > 0)
+					frnum = (pts*get_fps_k() + 500000000LL)/1000000000LL + 1;
+				if (!is_sampled(pts, dur)) {
+#ifdef QAV_REFCOUNTED_FRAMES
+					av_frame_unref(pFrame);
+#endif
+					continue;
 				}
 			}
 		}
-		av_free_packet(&packet);
-		if (is_read) return true;
-	}	
+		if (conv && conv->busy()) {
+			// the previous picture has been scaled while
+			// this one was being decoded
+			conv->finish(out);
+			out.set_pts(staged_pts);
+			if (_frnum) *_frnum = staged_frnum;
+			if (settings::SAVE_IMAGES)
+				save_frame(out, fname, staged_frnum);
+			if (got) stage_frame();
+			return true;
+		}
+		if (!got)
+			return false;
+		if (_frnum) *_frnum = frnum;
+		if (!skip) {
+			// fill_direct takes the decoded frame away
+			const long long	pts = frame_pts();
+			if (is_direct) {
+				fill_direct(out);
+			} else if (is_staged) {
+				// and go decoding the next one
+				stage_frame();
+				continue;
+			} else {
+				// Convert the image from its native format to the output one
+				conv->scale(pFrame->data, pFrame->linesize, out);
+			}
+			out.set_pts(pts);
+			if (settings::SAVE_IMAGES)
+				save_frame(out, fname, frnum);
+		}
+#ifdef QAV_REFCOUNTED_FRAMES
+		av_frame_unref(pFrame);
+#endif
+		return true;
+	}
+}
+
+bool qav::qvideo::skip_linear(const int& n) {
+	frame	dummy;
+	while (frnum < n)
+		if (!get_frame(dummy, 0, true))
+			return false;
+	return true;
+}
+
+bool qav::qvideo::seek_frame(const int& n) {
+	const AVStream	*st = pFormatCtx->streams[videoStream];
+	if (!is_cfr(st) || (pFormatCtx->iformat->flags & AVFMT_NOTIMESTAMPS))
+		return false;
+	// frame n (0 based) timestamp in the stream time base
+	const AVRational	frame_tb = { st->r_frame_rate.den, st->r_frame_rate.num };
+	const int64_t		start = (AV_NOPTS_VALUE != st->start_time) ? st->start_time : 0,
+				target = start + av_rescale_q(n, frame_tb, st->time_base);
+	// jump on the closest keyframe before the target
+	if (0 > av_seek_frame(pFormatCtx, videoStream, target, AVSEEK_FLAG_BACKWARD))
+		return false;
+	avcodec_flush_buffers(pCodecCtx);
+	is_flushing = false;
+	// then decode up to the exact frame, using the
+	// timestamps to know where we are. Frames have to come
+	// one index after the other, a gap means the rate isn't
+	// constant after all
+	int64_t	prev = -1;
+	while(decode_frame()) {
+		const int64_t	pts = pFrame->best_effort_timestamp;
+		if (AV_NOPTS_VALUE == pts)
+			break;
+		const int64_t	idx = av_rescale_q(pts - start, st->time_base, frame_tb);
+		if (0 <= prev && idx != prev + 1)
+			break;
+		prev = idx;
+		if (idx >= n) {
+			// landing after the target means the seek wasn't accurate
+			if (idx > n) break;
+			// keep this frame for the next get_frame
+			frnum = n;
+			is_pending = true;
+			return true;
+		}
+#ifdef QAV_REFCOUNTED_FRAMES
+		av_frame_unref(pFrame);
+#endif
+	}
+#ifdef QAV_REFCOUNTED_FRAMES
+	av_frame_unref(pFrame);
+#endif
+	// we don't know where we are anymore, go back to the start
+	LOG_WARNING << "Video (" << fname << ") can't seek accurately, rewinding" << std::endl;
+	if (0 > av_seek_frame(pFormatCtx, videoStream, start, AVSEEK_FLAG_BACKWARD))
+		throw std::runtime_error("Can't rewind video stream");
+	avcodec_flush_buffers(pCodecCtx);
+	is_flushing = false;
+	frnum = 0;
 	return false;
 }
 
+bool qav::qvideo::skip_frames(const int& n) {
+	if (n <= frnum)
+		return true;
+	// seeking only makes sense from the beginning, when
+	// the frame counter is still in sync with the stream
+	if (0 == frnum && !is_pending && seek_frame(n)) {
+		LOG_INFO << "Video (" << fname << ") seeked to frame " << n << std::endl;
+		return true;
+	}
+	LOG_INFO << "Video (" << fname << ") decoding up to frame " << n << std::endl;
+	return skip_linear(n);
+}
+
 /*bool SaveTGA(char *name, const unsigned char *data, int sizeX, int sizeY) {
 	BYTE	TGAheader[12]={0,0,2,0,0,0,0,0,0,0,0,0};
 	BYTE	header[6];
@@ -156,43 +424,72 @@ bool qav::qvideo::get_frame(std::vector<unsigned char>& out, int *_frnum, const
 	return true;
 }*/
 
-void qav::qvideo::save_frame(const unsigned char *buf, const char* __fname) {
+void qav::save_frame(const frame& f, const std::string& fname, const int& frnum) {
 	FILE 		*pFile;
 	std::string	s_fname;
 	char		num_buf[32];
+	// planar frames are saved as luma only (pgm format)
+	const bool	is_rgb = (PL_RGB24 == f.layout());
 
 	//
-	sprintf(num_buf, ".%08d.ppm", frnum);
+	sprintf(num_buf, is_rgb ? ".%08d.ppm" : ".%08d.pgm", frnum);
 	num_buf[31] = '\0';
 	std::ostringstream oss;
-	oss << ((__fname) ? __fname : fname.c_str()) << num_buf;
+	oss << fname << num_buf;
 	// Open file
 	pFile=fopen(oss.str().c_str(), "wb");
 	if(pFile==NULL)
 		return;
 
 	// Write header
-	fprintf(pFile, "P6\n%d %d\n255\n", out_width, out_height);
+	fprintf(pFile, is_rgb ? "P6\n%d %d\n%d\n" : "P5\n%d %d\n%d\n", f.width(), f.height(), (1 << f.depth()) - 1);
 
-	// Write pixel data
-	for(int y=0; y<out_height; y++)
-		fwrite(buf+y*out_width*3, 1, out_width*3, pFile);
+	// Write pixel data, 16 bit samples are big endian in pgm
+	std::vector<unsigned char>	row(f.plane_width(0));
+	for(int y=0; y<f.height(); y++) {
+		const unsigned char	*p = f.data(0)+y*f.linesize(0);
+		if (2 == f.sample_bytes()) {
+			for(int x=0; x<f.width(); ++x) {
+				const unsigned short	v = ((const unsigned short*)p)[x];
+				row[2*x] = v >> 8;
+				row[2*x+1] = v & 0xff;
+			}
+			p = &row[0];
+		}
+		fwrite(p, 1, f.plane_width(0), pFile);
+	}
 
 	// Close file
 	fclose(pFile);
 }
 
+qav::frame_source* qav::open_source(const char* file, int out_width, int out_height, int n_threads) {
+	const char	*pdot = strrchr(file, '.');
+	const std::string	ext = pdot ? pdot : "";
+	if (ext == ".y4m")
+		return new qrawvideo(file, 0, out_width, out_height);
+	if (ext == ".yuv") {
+		if (settings::RAW_FORMAT.empty())
+			throw std::runtime_error("Raw video format not specified (use -y WIDTHxHEIGHT[:pixfmt[:fps]])");
+		return new qrawvideo(file, settings::RAW_FORMAT.c_str(), out_width, out_height);
+	}
+	return new qvideo(file, out_width, out_height, n_threads);
+}
+
 qav::qvideo::~qvideo() {
 	free_resources();
 }
 
 void qav::qvideo::free_resources(void) {
-	if (img_convert_ctx) {
-		sws_freeContext(img_convert_ctx);
-		img_convert_ctx = 0;
-	}
+	// waits for a picture still being scaled
+	delete conv;
+	conv = 0;
 	if (pFrame) {
+#ifdef QAV_REFCOUNTED_FRAMES
+		av_frame_free(&pFrame);
+#else
 		av_free(pFrame);
+#endif
 		pFrame = 0;
 	}
 	if (pCodecCtx) {
@@ -29,6 +29,8 @@ extern "C" {
 
 #include <string>
 #include <vector>
+#include "frame.h"
+#include "scaler.h"
 
 namespace qav {
 	struct scr_size {
@@ -42,7 +44,51 @@ namespace qav {
 		}
 	};
 
-	class qvideo {
+	// anything the analyzed frames can be read from
+	class frame_source {
+	protected:
+		long long	smp_num,
+				smp_den,
+				smp_tol;
+
+		// a frame lasting from pts to pts+duration is sampled when
+		// it's the one shown at a sampling time (plus tolerance)
+		bool is_sampled(const long long& pts, const long long& duration) const {
+			if (smp_num <= 0) return true;
+			const long long	k = (pts > smp_tol) ? ((pts - smp_tol)*smp_den + smp_num - 1)/smp_num : 0;
+			return k*smp_num/smp_den + smp_tol < pts + duration;
+		}
+	public:
+		frame_source() : smp_num(0), smp_den(1), smp_tol(0) {
+		}
+
+		// only give the frames shown every num/den microseconds, a
+		// frame being shown from tol before its pts; num 0 for all
+		virtual void set_sampling(const long long& num, const long long& den, const long long& tol) {
+			smp_num = num;
+			smp_den = den;
+			smp_tol = tol;
+		}
+
+		virtual scr_size get_size(void) const = 0;
+		virtual int get_fps_k(void) const = 0;
+		// bits per sample of the source pictures
+		virtual int get_depth(void) const = 0;
+		virtual void set_layout(const pix_layout& layout) = 0;
+		virtual bool get_frame(frame& out, int *_frnum = 0, const bool skip = false) = 0;
+		virtual bool skip_frames(const int& n) = 0;
+		virtual ~frame_source() {
+		}
+	};
+
+	// save a frame as ppm (rgb) or pgm (luma of planar frames)
+	extern void save_frame(const frame& f, const std::string& fname, const int& frnum);
+
+	// open the right source for the file: raw .yuv and .y4m
+	// files get memory mapped, everything else goes through libav
+	extern frame_source* open_source(const char* file, int out_width = -1, int out_height = -1, int n_threads = 1);
+
+	class qvideo : public frame_source {
 		int frnum;
 		int videoStream;
 		int out_width;
@@ -51,15 +97,32 @@ namespace qav {
 		AVCodecContext    *pCodecCtx;
 		AVCodec           *pCodec;
 		AVFrame           *pFrame;
-		struct SwsContext *img_convert_ctx;
+		scaler            *conv;
+		pix_layout         out_layout;
+		bool               is_direct;
+		bool               is_staged;   // scaling runs on the pool while decoding
+		bool               is_flushing;
+		bool               is_pending;
+		int                staged_frnum;
+		long long          staged_pts;
 		std::string        fname;
 		void free_resources(void);
+		bool decode_frame(void);
+		void stage_frame(void);
+		void set_discard(const AVPacket& packet);
+		long long frame_pts(void) const;
+		long long frame_duration(void) const;
+		bool seek_frame(const int& n);
+		bool skip_linear(const int& n);
+		void fill_direct(frame& out);
 	public:
-		qvideo(const char* file, int _out_width = -1, int _out_height = -1);
+		qvideo(const char* file, int _out_width = -1, int _out_height = -1, int n_threads = 1);
 		scr_size get_size(void) const;
 		int get_fps_k(void) const;
-		bool get_frame(std::vector<unsigned char>& out, int *_frnum = 0, const bool skip = false);
-		void save_frame(const unsigned char *buf, const char* __fname = 0);
+		int get_depth(void) const;
+		void set_layout(const pix_layout& layout);
+		bool get_frame(frame& out, int *_frnum = 0, const bool skip = false);
+		bool skip_frames(const int& n);
 		~qvideo();
 	};
 }
@@ -0,0 +1,309 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "qcache.h"
+#include "qraw.h"
+#include "settings.h"
+#include <stdexcept>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#include <unistd.h>
+
+namespace {
+	const char	*CACHE_PREFIX = "qpsnr-",
+			*CACHE_EXT = ".y4m",
+			*PTS_EXT = ".pts";
+
+	// FNV-1a, 64 bits
+	unsigned long long fnv1a(const std::string& s) {
+		unsigned long long	h = 14695981039346656037ULL;
+		for(std::string::const_iterator it = s.begin(); it != s.end(); ++it) {
+			h ^= (unsigned char)*it;
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	// y4m 'C' tag of a layout, rgb24 isn't standard
+	const char *y4m_tag(const qav::pix_layout& layout) {
+		switch(layout) {
+			case qav::PL_RGB24:
+				return "rgb24";
+			case qav::PL_YUV420P10:
+				return "420p10";
+			case qav::PL_YUV420P12:
+				return "420p12";
+			default:
+				break;
+		}
+		return "420jpeg";
+	}
+
+	std::string cache_path(const char* file, const qav::scr_size& sz, const qav::pix_layout& layout) {
+		char		r_path[PATH_MAX];
+		struct stat	st;
+		if (!realpath(file, r_path) || 0 != stat(r_path, &st))
+			throw std::runtime_error("Can't get reference file identity");
+		char		key[256];
+		snprintf(key, sizeof(key), "|%lld|%lld|%dx%d|%d", (long long)st.st_size, (long long)st.st_mtime, sz.x, sz.y, (int)layout);
+		// and every option changing the stored pixels: the scaling
+		// algorithm (also used by format conversions) and how raw
+		// files are read
+		const std::string	opts = std::string("|") + settings::SCALER + '|' + settings::RAW_FORMAT;
+		char		name[64];
+		snprintf(name, sizeof(name), "%s%016llx%s", CACHE_PREFIX, fnv1a(std::string(r_path) + key + opts), CACHE_EXT);
+		return settings::CACHE_DIR + '/' + name;
+	}
+
+	struct cache_entry {
+		std::string	path;
+		off_t		size;
+		time_t		mtime;
+
+		bool operator<(const cache_entry& rhs) const {
+			return mtime < rhs.mtime;
+		}
+	};
+
+	// drop the least recently used entries until the cache
+	// fits in settings::CACHE_SIZE MB
+	void evict(void) {
+		DIR	*dir = opendir(settings::CACHE_DIR.c_str());
+		if (!dir) return;
+		std::vector<cache_entry>	v_entries;
+		unsigned long long		total = 0;
+		const size_t			pfx_len = strlen(CACHE_PREFIX),
+						ext_len = strlen(CACHE_EXT);
+		struct dirent			*de = 0;
+		while((de = readdir(dir))) {
+			const size_t	len = strlen(de->d_name);
+			if (len <= pfx_len + ext_len || 0 != strncmp(de->d_name, CACHE_PREFIX, pfx_len) || 0 != strcmp(de->d_name + len - ext_len, CACHE_EXT))
+				continue;
+			cache_entry	ce;
+			ce.path = settings::CACHE_DIR + '/' + de->d_name;
+			struct stat	st;
+			if (0 != stat(ce.path.c_str(), &st)) continue;
+			ce.size = st.st_size;
+			ce.mtime = st.st_mtime;
+			if (0 == stat((ce.path + PTS_EXT).c_str(), &st))
+				ce.size += st.st_size;
+			total += ce.size;
+			v_entries.push_back(ce);
+		}
+		closedir(dir);
+		std::sort(v_entries.begin(), v_entries.end());
+		const unsigned long long	limit = (unsigned long long)settings::CACHE_SIZE*1024*1024;
+		for(std::vector<cache_entry>::const_iterator it = v_entries.begin(); it != v_entries.end() && total > limit; ++it) {
+			if (0 != unlink(it->path.c_str())) continue;
+			unlink((it->path + PTS_EXT).c_str());
+			total -= it->size;
+			LOG_INFO << "Reference cache: evicted " << it->path << std::endl;
+		}
+	}
+
+	// the timestamps of an entry, one line per frame; the y4m
+	// frame rate alone can't tell them for variable frame rate
+	// sources or ones with gaps
+	bool write_pts(const std::string& path, const std::vector<long long>& v_pts) {
+		FILE	*f = fopen(path.c_str(), "w");
+		if (!f) return false;
+		bool	ok = true;
+		for(std::vector<long long>::const_iterator it = v_pts.begin(); ok && it != v_pts.end(); ++it)
+			ok = (0 < fprintf(f, "%lld\n", *it));
+		if (0 != fclose(f)) ok = false;
+		return ok;
+	}
+
+	bool read_pts(const std::string& path, std::vector<long long>& v_pts) {
+		FILE	*f = fopen(path.c_str(), "r");
+		if (!f) return false;
+		long long	pts = 0;
+		while(1 == fscanf(f, "%lld", &pts))
+			v_pts.push_back(pts);
+		const bool	ok = feof(f);
+		fclose(f);
+		return ok;
+	}
+
+	// Passes the frames of the wrapped source through, writing
+	// them in a temporary file which becomes the cache entry once
+	// the source is over. Anything else (seeking, skipped frames,
+	// write errors, stopping early) drops the temporary file
+	class cache_writer : public qav::frame_source {
+		std::auto_ptr<qav::frame_source>	_src;
+		std::string				_path,
+							_tmp_path;
+		FILE					*_f;
+		int					_n_frames;
+		std::vector<long long>			_v_pts;
+
+		void abort(const char* why) {
+			if (!_f) return;
+			fclose(_f);
+			_f = 0;
+			unlink(_tmp_path.c_str());
+			LOG_INFO << "Reference cache: not stored (" << why << ')' << std::endl;
+		}
+
+		void commit(void) {
+			if (!_f) return;
+			if (0 == _n_frames) {
+				abort("no frames");
+				return;
+			}
+			const bool	ok = (0 == fclose(_f));
+			_f = 0;
+			// the timestamps go in place first, an entry is there
+			// only once its frames are
+			const std::string	tmp_pts = _tmp_path + PTS_EXT,
+						pts = _path + PTS_EXT;
+			if (!ok || !write_pts(tmp_pts, _v_pts) || 0 != rename(tmp_pts.c_str(), pts.c_str()) || 0 != rename(_tmp_path.c_str(), _path.c_str())) {
+				unlink(_tmp_path.c_str());
+				unlink(tmp_pts.c_str());
+				LOG_WARNING << "Reference cache: can't store " << _path << std::endl;
+				return;
+			}
+			LOG_INFO << "Reference cache: stored " << _n_frames << " frames in " << _path << std::endl;
+			evict();
+		}
+
+		void write(const qav::frame& f) {
+			if (0 == _n_frames) {
+				// the layout is final once frames come out
+				const qav::scr_size	sz = _src->get_size();
+				if (0 > fprintf(_f, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C%s\n", sz.x, sz.y, _src->get_fps_k(), y4m_tag(f.layout()))) {
+					abort("write error");
+					return;
+				}
+			}
+			bool	ok = (6 == fwrite("FRAME\n", 1, 6, _f));
+			for(int i = 0; ok && i < f.n_planes(); ++i)
+				for(int j = 0; ok && j < f.plane_height(i); ++j)
+					ok = ((size_t)f.plane_width(i) == fwrite(f.data(i) + j*f.linesize(i), 1, f.plane_width(i), _f));
+			if (!ok) {
+				abort("write error");
+				return;
+			}
+			_v_pts.push_back(f.pts());
+			++_n_frames;
+		}
+	public:
+		cache_writer(qav::frame_source* src, const std::string& path) : _src(src), _path(path), _f(0), _n_frames(0) {
+			char	pid[32];
+			snprintf(pid, sizeof(pid), ".%d.tmp", (int)getpid());
+			_tmp_path = _path + pid;
+			_f = fopen(_tmp_path.c_str(), "wb");
+			if (!_f)
+				LOG_WARNING << "Reference cache: can't create " << _tmp_path << std::endl;
+		}
+
+		qav::scr_size get_size(void) const {
+			return _src->get_size();
+		}
+
+		int get_fps_k(void) const {
+			return _src->get_fps_k();
+		}
+
+		int get_depth(void) const {
+			return _src->get_depth();
+		}
+
+		void set_layout(const qav::pix_layout& layout) {
+			_src->set_layout(layout);
+		}
+
+		bool get_frame(qav::frame& out, int *_frnum = 0, const bool skip = false) {
+			const bool	ret = _src->get_frame(out, _frnum, skip);
+			if (!_f) return ret;
+			if (!ret) commit();
+			else if (skip) abort("frames skipped");
+			else write(out);
+			return ret;
+		}
+
+		void set_sampling(const long long& num, const long long& den, const long long& tol) {
+			if (num > 0) abort("frames sampled");
+			_src->set_sampling(num, den, tol);
+		}
+
+		bool skip_frames(const int& n) {
+			if (n > 0) abort("frames skipped");
+			return _src->skip_frames(n);
+		}
+
+		~cache_writer() {
+			abort("reference not read till the end");
+		}
+	};
+}
+
+qav::frame_source* qav::cache_source(frame_source* src, const char* file, const pix_layout& layout) {
+	std::auto_ptr<frame_source>	p_src(src);
+	if (settings::CACHE_DIR.empty())
+		return p_src.release();
+	std::string	path;
+	try {
+		path = cache_path(file, p_src->get_size(), layout);
+	} catch(std::exception& e) {
+		LOG_WARNING << "Reference cache: " << e.what() << std::endl;
+		return p_src.release();
+	}
+	if (0 == access(path.c_str(), R_OK)) {
+		try {
+			std::auto_ptr<qrawvideo>	p_cached(new qrawvideo(path.c_str(), 0));
+			std::vector<long long>		v_pts;
+			if (!read_pts(path + PTS_EXT, v_pts))
+				throw std::runtime_error("missing or bad timestamps");
+			// the original timestamps, not the ones from the frame rate
+			p_cached->set_pts(v_pts);
+			if (p_cached->get_size() == p_src->get_size() && p_cached->get_fps_k() == p_src->get_fps_k()) {
+				// keep it as recently used
+				utime(path.c_str(), 0);
+				LOG_INFO << "Reference cache: hit " << path << std::endl;
+				p_cached->set_layout(layout);
+				return p_cached.release();
+			}
+			LOG_WARNING << "Reference cache: " << path << " doesn't match the reference, replacing it" << std::endl;
+		} catch(std::exception& e) {
+			LOG_WARNING << "Reference cache: " << path << " can't be used (" << e.what() << "), replacing it" << std::endl;
+		}
+	}
+	// a partial run can't fill the cache
+	if (settings::SKIP_FRAMES > 0 || settings::MAX_FRAMES > 0 || settings::SAMPLE_EVERY > 1) {
+		LOG_INFO << "Reference cache: miss, not stored (skip, max frames or sampling set)" << std::endl;
+		return p_src.release();
+	}
+	if (0 != mkdir(settings::CACHE_DIR.c_str(), 0755) && EEXIST != errno) {
+		LOG_WARNING << "Reference cache: can't create " << settings::CACHE_DIR << std::endl;
+		return p_src.release();
+	}
+	LOG_INFO << "Reference cache: miss, storing the reference in " << path << std::endl;
+	return new cache_writer(p_src.release(), path);
+}
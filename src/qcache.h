@@ -0,0 +1,40 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _QCACHE_H_
+#define _QCACHE_H_
+
+#include "qav.h"
+
+namespace qav {
+	// On disk cache of decoded reference frames (settings::CACHE_DIR).
+	// Entries are YUV4MPEG2 files already scaled and converted to the
+	// analyzer layout, keyed by the reference file identity (path,
+	// size, mtime), the analysis size, the layout and the options
+	// changing the decoded pixels (scaler, raw format); the frames
+	// timestamps are kept aside (.pts) so that they come back as the
+	// original ones, whatever the frame rate.
+	// On a hit src is released and the cached frames (memory mapped)
+	// are returned, on a miss src gets wrapped so that a complete run
+	// stores its frames for the next ones.
+	// Ownership of src is always taken
+	extern frame_source* cache_source(frame_source* src, const char* file, const pix_layout& layout);
+}
+
+#endif /*_QCACHE_H_*/
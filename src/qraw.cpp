@@ -0,0 +1,327 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "qraw.h"
+#include "kernels.h"
+#include "settings.h"
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+	struct raw_pix_fmt {
+		const char	*name;
+		PixelFormat	fmt;
+		int		planes,
+				spp,	// samples per pixel of the first plane
+				bps,	// bytes per sample
+				shift_x,
+				shift_y;
+	};
+
+	const raw_pix_fmt	raw_fmts[] = {
+		{ "yuv420p", PIX_FMT_YUV420P, 3, 1, 1, 1, 1 },
+		{ "yuv422p", PIX_FMT_YUV422P, 3, 1, 1, 1, 0 },
+		{ "yuv444p", PIX_FMT_YUV444P, 3, 1, 1, 0, 0 },
+		{ "yuv420p10le", PIX_FMT_YUV420P10LE, 3, 1, 2, 1, 1 },
+		{ "yuv420p12le", PIX_FMT_YUV420P12LE, 3, 1, 2, 1, 1 },
+		{ "gray", PIX_FMT_GRAY8, 1, 1, 1, 0, 0 },
+		{ "rgb24", PIX_FMT_RGB24, 1, 3, 1, 0, 0 },
+		{ 0, PIX_FMT_NONE, 0, 0, 0, 0, 0 }
+	};
+
+	const raw_pix_fmt* find_fmt(const PixelFormat& fmt) {
+		for(const raw_pix_fmt *p = raw_fmts; p->name; ++p)
+			if (p->fmt == fmt) return p;
+		throw std::runtime_error("Unsupported raw pixel format");
+	}
+
+	const raw_pix_fmt* find_fmt(const std::string& name) {
+		for(const raw_pix_fmt *p = raw_fmts; p->name; ++p)
+			if (name == p->name) return p;
+		throw std::runtime_error("Unsupported raw pixel format (use yuv420p, yuv422p, yuv444p, yuv420p10le, yuv420p12le, gray or rgb24)");
+	}
+
+	// y4m 'C' tag to pixel format
+	PixelFormat y4m_fmt(const std::string& c) {
+		if (c == "420p10") return PIX_FMT_YUV420P10LE;
+		if (c == "420p12") return PIX_FMT_YUV420P12LE;
+		if (c.find("420") == 0) return PIX_FMT_YUV420P;
+		if (c == "422") return PIX_FMT_YUV422P;
+		if (c == "444") return PIX_FMT_YUV444P;
+		if (c == "mono") return PIX_FMT_GRAY8;
+		// not standard, written by the reference cache
+		if (c == "rgb24") return PIX_FMT_RGB24;
+		throw std::runtime_error("Unsupported y4m colorspace");
+	}
+}
+
+qav::qrawvideo::qrawvideo(const char* file, const char* raw_fmt, int _out_width, int _out_height) : frnum(0), n_frames(0), in_width(0),
+in_height(0), out_width(_out_width), out_height(_out_height), fps_num(25), fps_den(1), in_fmt(PIX_FMT_YUV420P), in_planes(0), fd(-1),
+map(0), map_sz(0), first_off(0), frame_hdr_sz(0), frame_sz(0), conv(NULL), out_layout(PL_RGB24), is_direct(false) {
+	const char* pslash = strrchr(file, '/');
+	if (pslash)
+		fname = pslash+1;
+	else
+		fname = file;
+
+	try {
+		fd = open(file, O_RDONLY);
+		if (-1 == fd)
+			throw std::runtime_error("Can't open file");
+		struct stat	st;
+		if (0 != fstat(fd, &st) || 0 == st.st_size)
+			throw std::runtime_error("Can't get file size or file is empty");
+		map_sz = st.st_size;
+		void	*p = mmap(0, map_sz, PROT_READ, MAP_SHARED, fd, 0);
+		if (MAP_FAILED == p)
+			throw std::runtime_error("Can't memory map file");
+		map = (unsigned char*)p;
+		// we'll go through it once, from start to end
+		madvise(map, map_sz, MADV_SEQUENTIAL);
+
+		if (raw_fmt) parse_raw_format(raw_fmt);
+		else parse_y4m_header();
+		setup_planes();
+		n_frames = (map_sz - first_off)/(frame_hdr_sz + frame_sz);
+		LOG_INFO << "File info for (" << file << "): " << in_width << 'x' << in_height << ' ' << find_fmt(in_fmt)->name
+			<< ", " << fps_num << '/' << fps_den << " fps, " << n_frames << " frames (memory mapped)" << std::endl;
+
+		// populate the out_width/out_height members
+		if (out_width > 0 && out_height > 0) {
+			LOG_INFO << "Output frame size for (" << file << ") is: " << out_width << 'x' << out_height << std::endl;
+		} else if (-1 == out_width && -1 == out_height) {
+			out_width = in_width;
+			out_height = in_height;
+			LOG_INFO << "Output frame size for (" << file << ") (default) is: " << out_width << 'x' << out_height << std::endl;
+		} else throw std::runtime_error("Invalid output frame size for video stream");
+		// just report if we're using a different video size
+		if (out_width!=in_width || out_height!=in_height)
+			LOG_WARNING << "Video (" << file <<") will get scaled: " << in_width << 'x' << in_height << " (in), " << out_width << 'x' << out_height << " (out)" << std::endl;
+
+		set_layout(PL_RGB24);
+	} catch(...) {
+		free_resources();
+		throw;
+	}
+}
+
+void qav::qrawvideo::parse_raw_format(const char* raw_fmt) {
+	// WIDTHxHEIGHT[:pixfmt[:fps]]
+	const std::string	s_fmt(raw_fmt);
+	const size_t		p_x = s_fmt.find_first_of("xX"),
+				p_c1 = s_fmt.find(':'),
+				p_c2 = (std::string::npos == p_c1) ? std::string::npos : s_fmt.find(':', p_c1+1);
+	if (std::string::npos == p_x || (std::string::npos != p_c1 && p_c1 < p_x))
+		throw std::runtime_error("Invalid raw video format (use WIDTHxHEIGHT[:pixfmt[:fps]], ie. 1920x1080:yuv420p:25)");
+	in_width = atoi(s_fmt.substr(0, p_x).c_str());
+	in_height = atoi(s_fmt.substr(p_x+1, p_c1-p_x-1).c_str());
+	if (in_width <= 0 || in_height <= 0)
+		throw std::runtime_error("Invalid raw video size, negative or 0 width/height");
+	if (std::string::npos != p_c1)
+		in_fmt = find_fmt(s_fmt.substr(p_c1+1, p_c2-p_c1-1))->fmt;
+	if (std::string::npos != p_c2) {
+		fps_num = atoi(s_fmt.substr(p_c2+1).c_str());
+		if (fps_num <= 0)
+			throw std::runtime_error("Invalid raw video fps");
+	}
+	first_off = 0;
+	frame_hdr_sz = 0;
+}
+
+void qav::qrawvideo::parse_y4m_header(void) {
+	// YUV4MPEG2 W<w> H<h> F<n>:<d> C<cs> ...\n
+	const char	*p = (const char*)map,
+			*p_end = (const char*)memchr(map, '\n', map_sz);
+	if (!p_end || map_sz < 9 || 0 != memcmp(p, "YUV4MPEG2", 9))
+		throw std::runtime_error("Invalid y4m header");
+	const std::string	hdr(p+9, p_end);
+	size_t			pos = 0;
+	while(pos < hdr.size()) {
+		const size_t		next = hdr.find(' ', pos);
+		const std::string	tag = hdr.substr(pos, next-pos);
+		pos = (std::string::npos == next) ? hdr.size() : next+1;
+		if (tag.empty()) continue;
+		const std::string	val = tag.substr(1);
+		switch(tag[0]) {
+			case 'W':
+				in_width = atoi(val.c_str());
+				break;
+			case 'H':
+				in_height = atoi(val.c_str());
+				break;
+			case 'F':
+				{
+					const size_t	p_c = val.find(':');
+					if (std::string::npos == p_c)
+						throw std::runtime_error("Invalid y4m frame rate");
+					fps_num = atoi(val.substr(0, p_c).c_str());
+					fps_den = atoi(val.substr(p_c+1).c_str());
+				}
+				break;
+			case 'C':
+				in_fmt = y4m_fmt(val);
+				break;
+			default:
+				break;
+		}
+	}
+	if (in_width <= 0 || in_height <= 0 || fps_num <= 0 || fps_den <= 0)
+		throw std::runtime_error("Invalid y4m size or frame rate");
+	first_off = p_end - p + 1;
+	// all the frame headers are assumed to be like the first one
+	const char	*f_end = (const char*)memchr(map + first_off, '\n', map_sz - first_off);
+	if (!f_end || 0 != memcmp(map + first_off, "FRAME", std::min((size_t)5, map_sz - first_off)))
+		throw std::runtime_error("Invalid y4m frame header");
+	frame_hdr_sz = f_end - (const char*)map - first_off + 1;
+}
+
+void qav::qrawvideo::setup_planes(void) {
+	const raw_pix_fmt	*rf = find_fmt(in_fmt);
+	in_planes = rf->planes;
+	frame_sz = 0;
+	for(int i = 0; i < 3; ++i) {
+		plane_off[i] = frame_sz;
+		plane_ls[i] = 0;
+		if (i >= in_planes) continue;
+		const int	w = rf->bps*((0 == i) ? rf->spp*in_width : (in_width + (1 << rf->shift_x) - 1) >> rf->shift_x),
+				h = (0 == i) ? in_height : (in_height + (1 << rf->shift_y) - 1) >> rf->shift_y;
+		plane_ls[i] = w;
+		frame_sz += (size_t)w*h;
+	}
+}
+
+qav::scr_size qav::qrawvideo::get_size(void) const {
+	return scr_size(out_width, out_height);
+}
+
+int qav::qrawvideo::get_fps_k(void) const {
+	return 1000*fps_num/fps_den;
+}
+
+int qav::qrawvideo::get_depth(void) const {
+	return scaler::depth(in_fmt);
+}
+
+void qav::qrawvideo::set_layout(const pix_layout& layout) {
+	delete conv;
+	conv = 0;
+	out_layout = layout;
+	is_direct = scaler::fmt(out_layout) == in_fmt && out_width == in_width && out_height == in_height;
+	if (is_direct) {
+		LOG_INFO << "Video (" << fname << ") frames are used from the file mapping (no conversion)" << std::endl;
+		return;
+	}
+	conv = new scaler(in_width, in_height, in_fmt, out_width, out_height, out_layout);
+}
+
+long long qav::qrawvideo::frame_pts(const int& n) const {
+	if (!v_pts.empty()) return v_pts[n];
+	return 1000000LL*n*fps_den/fps_num;
+}
+
+long long qav::qrawvideo::frame_duration(const int& n) const {
+	if (!v_pts.empty() && n + 1 < n_frames) return v_pts[n + 1] - v_pts[n];
+	return 1000000LL*fps_den/fps_num;
+}
+
+void qav::qrawvideo::set_pts(const std::vector<long long>& pts) {
+	if (pts.size() != (size_t)n_frames)
+		throw std::runtime_error("Timestamps don't match the frames");
+	v_pts = pts;
+}
+
+bool qav::qrawvideo::get_frame(frame& out, int *_frnum, const bool skip) {
+	// frames not sampled are just passed over
+	while (!skip && frnum < n_frames && !is_sampled(frame_pts(frnum), frame_duration(frnum)))
+		++frnum;
+	if (frnum >= n_frames)
+		return false;
+	const size_t	f_step = frame_hdr_sz + frame_sz;
+	unsigned char	*p = map + first_off + frnum*f_step;
+	if (frame_hdr_sz && 0 != memcmp(p, "FRAME", 5)) {
+		LOG_ERROR << "Video (" << fname << ") has an invalid frame header at frame " << frnum+1 << std::endl;
+		return false;
+	}
+	p += frame_hdr_sz;
+	++frnum;
+	if (_frnum) *_frnum = frnum;
+	// ask the kernel to start reading the next frame
+	if (frnum < n_frames) {
+		const size_t	pg_mask = sysconf(_SC_PAGESIZE) - 1,
+				next = (first_off + frnum*f_step) & ~pg_mask;
+		madvise(map + next, std::min(f_step + pg_mask + 1, map_sz - next), MADV_WILLNEED);
+	}
+	if (!skip) {
+		unsigned char	*data[3];
+		for(int i = 0; i < 3; ++i)
+			data[i] = (i < in_planes) ? p + plane_off[i] : 0;
+		if (is_direct) {
+			out.set_ref(out_layout, out_width, out_height, data, plane_ls, map, 0);
+		} else {
+			conv->scale(data, plane_ls, out);
+		}
+		// the 16 bit kernels only take samples within the depth
+		if (8 < out.depth())
+			for(int i = 0; i < out.n_planes(); ++i)
+				if (kernels::above_depth16((const unsigned short*)out.data(i), out.linesize(i)/2, out.plane_samples(i), out.plane_height(i), out.depth())) {
+					LOG_ERROR << "Video (" << fname << ") has samples above " << out.depth() << " bits at frame " << frnum << std::endl;
+					return false;
+				}
+		out.set_pts(frame_pts(frnum - 1));
+		if (settings::SAVE_IMAGES)
+			save_frame(out, fname, frnum);
+	}
+	return true;
+}
+
+bool qav::qrawvideo::skip_frames(const int& n) {
+	// every frame has the same size, just move on
+	if (n > n_frames) {
+		frnum = n_frames;
+		return false;
+	}
+	if (n > frnum) {
+		frnum = n;
+		LOG_INFO << "Video (" << fname << ") moved to frame " << n << std::endl;
+	}
+	return true;
+}
+
+qav::qrawvideo::~qrawvideo() {
+	free_resources();
+}
+
+void qav::qrawvideo::free_resources(void) {
+	delete conv;
+	conv = 0;
+	if (map) {
+		munmap(map, map_sz);
+		map = 0;
+	}
+	if (-1 != fd) {
+		close(fd);
+		fd = -1;
+	}
+}
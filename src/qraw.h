@@ -0,0 +1,77 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _QRAW_H_
+#define _QRAW_H_
+
+#include "qav.h"
+#include <vector>
+
+namespace qav {
+	// Raw planar video (.yuv) or YUV4MPEG2 (.y4m) file.
+	// The file is memory mapped and, when no conversion is
+	// needed, frames point straight into the mapping
+	class qrawvideo : public frame_source {
+		int frnum;
+		int n_frames;
+		int in_width;
+		int in_height;
+		int out_width;
+		int out_height;
+		int fps_num;
+		int fps_den;
+		PixelFormat        in_fmt;
+		int                in_planes;
+		size_t             plane_off[3];
+		int                plane_ls[3];
+		int                fd;
+		unsigned char      *map;
+		size_t             map_sz;
+		size_t             first_off;   // first frame (header included)
+		size_t             frame_hdr_sz;  // "FRAME\n" for y4m, 0 for raw
+		size_t             frame_sz;    // picture data of a frame
+		scaler            *conv;
+		pix_layout         out_layout;
+		bool               is_direct;
+		std::string        fname;
+		std::vector<long long> v_pts;   // given timestamps, empty for the frame rate ones
+		void free_resources(void);
+		long long frame_pts(const int& n) const;
+		long long frame_duration(const int& n) const;
+		void parse_raw_format(const char* raw_fmt);
+		void parse_y4m_header(void);
+		void setup_planes(void);
+	public:
+		// raw_fmt is WIDTHxHEIGHT[:pixfmt[:fps]], 0 for y4m files
+		qrawvideo(const char* file, const char* raw_fmt, int _out_width = -1, int _out_height = -1);
+		scr_size get_size(void) const;
+		int get_fps_k(void) const;
+		int get_depth(void) const;
+		void set_layout(const pix_layout& layout);
+		bool get_frame(frame& out, int *_frnum = 0, const bool skip = false);
+		bool skip_frames(const int& n);
+		// timestamps (microseconds) of all the frames in place of
+		// the ones from the frame rate, ie. the original ones of
+		// a cached video; throws when they're not one per frame
+		void set_pts(const std::vector<long long>& pts);
+		~qrawvideo();
+	};
+}
+
+#endif /*_QRAW_H_*/
@@ -0,0 +1,177 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "scaler.h"
+#include "mt.h"
+#include "settings.h"
+#include <stdexcept>
+
+namespace {
+	struct sws_algo {
+		const char	*name;
+		int		flag;
+	};
+
+	const sws_algo	sws_algos[] = {
+		{ "fast_bilinear", SWS_FAST_BILINEAR },
+		{ "bilinear", SWS_BILINEAR },
+		{ "bicubic", SWS_BICUBIC },
+		{ "point", SWS_POINT },
+		{ "area", SWS_AREA },
+		{ "bicublin", SWS_BICUBLIN },
+		{ "gauss", SWS_GAUSS },
+		{ "sinc", SWS_SINC },
+		{ "lanczos", SWS_LANCZOS },
+		{ "spline", SWS_SPLINE },
+		{ 0, 0 }
+	};
+
+	struct fmt_depth {
+		PixelFormat	fmt;
+		int		depth;
+	};
+
+	// 9 bits sources are analyzed as 10 bits ones
+	const fmt_depth	fmt_depths[] = {
+		{ PIX_FMT_YUV420P9LE, 10 },
+		{ PIX_FMT_YUV420P9BE, 10 },
+		{ PIX_FMT_YUV420P10LE, 10 },
+		{ PIX_FMT_YUV420P10BE, 10 },
+		{ PIX_FMT_YUV422P10LE, 10 },
+		{ PIX_FMT_YUV422P10BE, 10 },
+		{ PIX_FMT_YUV444P10LE, 10 },
+		{ PIX_FMT_YUV444P10BE, 10 },
+		{ PIX_FMT_YUV420P12LE, 12 },
+		{ PIX_FMT_YUV420P12BE, 12 },
+		{ PIX_FMT_YUV422P12LE, 12 },
+		{ PIX_FMT_YUV422P12BE, 12 },
+		{ PIX_FMT_YUV444P12LE, 12 },
+		{ PIX_FMT_YUV444P12BE, 12 },
+		{ PIX_FMT_NONE, 0 }
+	};
+
+	// shared by all the videos, a job is a whole picture; created
+	// on first use, once main has set its share of the cores
+	mt::TaskPool& scale_tp(void) {
+		static mt::TaskPool	tp((settings::SCALER_THREADS > 0) ? settings::SCALER_THREADS : mt::get_cpu_count());
+		return tp;
+	}
+}
+
+namespace qav {
+	class scale_job : public mt::Task {
+		struct SwsContext	*_ctx;
+		const unsigned char	*_data[4];
+		int			_linesize[4],
+					_in_height;
+		frame			&_out;
+		void			*_ref;
+		void			(*_ref_free)(void*);
+		mt::Latch		_done;
+	public:
+		scale_job(struct SwsContext *ctx, const unsigned char* const data[], const int linesize[], const int& in_height, frame& out, void *ref, void (*ref_free)(void*)) :
+		_ctx(ctx), _in_height(in_height), _out(out), _ref(ref), _ref_free(ref_free), _done(1) {
+			for(int i = 0; i < 4; ++i) {
+				_data[i] = (i < 3) ? data[i] : 0;
+				_linesize[i] = (i < 3) ? linesize[i] : 0;
+			}
+		}
+
+		virtual void run(void) {
+			sws_scale(_ctx, _data, _linesize, 0, _in_height, _out.planes(), _out.linesizes());
+			if (_ref && _ref_free) _ref_free(_ref);
+			_ref = 0;
+			_done.count_down();
+		}
+
+		// the job can be deleted once this returns
+		void wait(void) {
+			scale_tp().wait(_done);
+		}
+	};
+}
+
+int qav::scaler::algo(const std::string& name) {
+	for(const sws_algo *p = sws_algos; p->name; ++p)
+		if (name == p->name) return p->flag;
+	throw std::runtime_error("Unknown scaler (use fast_bilinear, bilinear, bicubic, point, area, bicublin, gauss, sinc, lanczos or spline)");
+}
+
+PixelFormat qav::scaler::fmt(const pix_layout& layout) {
+	switch(layout) {
+		case PL_RGB24:
+			return PIX_FMT_RGB24;
+		case PL_YUV420P10:
+			return PIX_FMT_YUV420P10;
+		case PL_YUV420P12:
+			return PIX_FMT_YUV420P12;
+		default:
+			break;
+	}
+	return PIX_FMT_YUV420P;
+}
+
+int qav::scaler::depth(const PixelFormat& fmt) {
+	for(const fmt_depth *p = fmt_depths; PIX_FMT_NONE != p->fmt; ++p)
+		if (fmt == p->fmt) return p->depth;
+	return 8;
+}
+
+qav::scaler::scaler(const int& in_width, const int& in_height, const PixelFormat& in_fmt, const int& out_width, const int& out_height, const pix_layout& layout) :
+_ctx(0), _in_height(in_height), _out_width(out_width), _out_height(out_height), _layout(layout), _job(0) {
+	_ctx = sws_getContext(in_width, in_height, in_fmt, out_width, out_height, fmt(layout), algo(settings::SCALER), NULL, NULL, NULL);
+	if (!_ctx)
+		throw std::runtime_error("Can't allocated sw_scale context");
+}
+
+void qav::scaler::scale(const unsigned char* const data[], const int linesize[], frame& out) {
+	out.alloc(_layout, _out_width, _out_height);
+	sws_scale(_ctx, data, linesize, 0, _in_height, out.planes(), out.linesizes());
+}
+
+void qav::scaler::start(const unsigned char* const data[], const int linesize[], void *ref, void (*ref_free)(void*)) {
+	if (_job)
+		throw std::runtime_error("Scaler is already busy");
+	_out.alloc(_layout, _out_width, _out_height);
+	_job = new scale_job(_ctx, data, linesize, _in_height, _out, ref, ref_free);
+	try {
+		scale_tp().spawn(_job);
+	} catch(...) {
+		delete _job;
+		_job = 0;
+		throw;
+	}
+}
+
+void qav::scaler::finish(frame& out) {
+	if (!_job)
+		throw std::runtime_error("Scaler has no picture to give");
+	_job->wait();
+	delete _job;
+	_job = 0;
+	out.swap(_out);
+}
+
+qav::scaler::~scaler() {
+	if (_job) {
+		_job->wait();
+		delete _job;
+	}
+	sws_freeContext(_ctx);
+}
@@ -0,0 +1,80 @@
+/*
+*	qpsnr (C) 2010 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of qpsnr.
+*
+*	qpsnr is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	qpsnr is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with qpsnr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SCALER_H_
+#define _SCALER_H_
+
+// libavcodec is a C library without C++ guards...
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <string>
+#include "frame.h"
+
+namespace qav {
+	class scale_job;
+
+	// Conversion of the source pictures to the analysis size and
+	// layout (libswscale, algorithm from settings::SCALER).
+	// Pictures can be scaled straight away or on the scaling thread
+	// pool, so that the caller can decode the next one meanwhile
+	class scaler {
+		struct SwsContext	*_ctx;
+		int			_in_height,
+					_out_width,
+					_out_height;
+		pix_layout		_layout;
+		frame			_out;
+		scale_job		*_job;
+
+		scaler(const scaler&);
+		scaler& operator=(const scaler&);
+	public:
+		// SWS_* flag of a scaler name (ie. "bicubic", "lanczos")
+		static int algo(const std::string& name);
+
+		// pixel format of the frames of a layout
+		static PixelFormat fmt(const pix_layout& layout);
+
+		// bits per sample of a decoded pixel format: 10 or 12 for
+		// the high bit depth yuv ones, 8 for everything else
+		static int depth(const PixelFormat& fmt);
+
+		scaler(const int& in_width, const int& in_height, const PixelFormat& in_fmt, const int& out_width, const int& out_height, const pix_layout& layout);
+
+		void scale(const unsigned char* const data[], const int linesize[], frame& out);
+
+		// scale on the thread pool: the source planes have to stay
+		// valid till the job is over, then ref_free(ref) is called
+		void start(const unsigned char* const data[], const int linesize[], void *ref, void (*ref_free)(void*));
+
+		bool busy(void) const {
+			return 0 != _job;
+		}
+
+		// wait for the started job and get its picture
+		void finish(frame& out);
+
+		~scaler();
+	};
+}
+
+#endif /*_SCALER_H_*/
@@ -29,4 +29,15 @@ namespace settings {
 	bool        IGNORE_FPS = false;
 	int         VIDEO_SIZE_W = -1;
 	int         VIDEO_SIZE_H = -1;
+	int         DECODER_THREADS = 0;
+	int         SCALER_THREADS = 0;
+	int         STATS_THREADS = 0;
+	std::string RAW_FORMAT = "";
+	int         FRAME_QUEUE = 3;
+	bool        HUGE_PAGES = false;
+	std::string CACHE_DIR = "";
+	int         CACHE_SIZE = 10240;
+	std::string SCALER = "bicubic";
+	bool        SCALE_STAGE = true;
+	int         SAMPLE_EVERY = 1;
 }
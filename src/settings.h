@@ -45,6 +45,17 @@ namespace settings {
 	extern bool        IGNORE_FPS;
 	extern int         VIDEO_SIZE_W;
 	extern int         VIDEO_SIZE_H;
+	extern int         DECODER_THREADS;
+	extern int         SCALER_THREADS;  // set by main, 0 for all the cores
+	extern int         STATS_THREADS;   // set by main, 0 for all the cores
+	extern std::string RAW_FORMAT;
+	extern int         FRAME_QUEUE;
+	extern bool        HUGE_PAGES;
+	extern std::string CACHE_DIR;
+	extern int         CACHE_SIZE;
+	extern std::string SCALER;
+	extern bool        SCALE_STAGE;
+	extern int         SAMPLE_EVERY;
 }
 
 
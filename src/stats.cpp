@@ -18,326 +18,1006 @@
 */
 
 #include "stats.h"
+#include "scaler.h"
+#include "kernels.h"
 #include "mt.h"
 #include "shared_ptr.h"
 #include "settings.h"
 #include <cmath>
 #include <string>
 #include <stdexcept>
-#include <set>
-#include <fstream>
 #include <algorithm>
 #include <cstdlib>
+#include <cstdio>
 
 // define these classes just locally
 namespace stats {
-	static double compute_psnr(const unsigned char *ref, const unsigned char *cmp, const unsigned int& sz) {
-		double mse = 0.0;
-		for(unsigned int i = 0; i < sz; ++i) {
-			const int	diff = ref[i]-cmp[i];
-			mse += (diff*diff);
-		}
-		mse /= (double)sz;
+	static double sse_2_psnr(const unsigned long long& sse, const double& n_samples, const int& depth = 8) {
+		// the error is exact, the only rounding is from here on
+		double		mse = (double)sse/n_samples;
 		if (0.0 == mse) mse = 1e-10;
-		return 10.0*log10(65025.0/mse);
+		const double	peak = (1 << depth) - 1;
+		return 10.0*log10(peak*peak/mse);
+	}
+
+	// first row of band b, out of n_bands, of h rows
+	static inline unsigned int band_row(const unsigned int& h, const unsigned int& b, const unsigned int& n_bands) {
+		return (unsigned long long)h*b/n_bands;
+	}
+
+	// sse of band b (out of n_bands) of plane p
+	static unsigned long long compute_sse(const qav::frame& ref, const qav::frame& cmp, const int& p, const unsigned int& b, const unsigned int& n_bands) {
+		const unsigned int	h = ref.plane_height(p),
+					j0 = band_row(h, b, n_bands),
+					j1 = band_row(h, b+1, n_bands);
+		if (2 == ref.sample_bytes()) {
+			const int	ref_ls = ref.linesize(p)/2,
+					cmp_ls = cmp.linesize(p)/2;
+			return kernels::sse16((const unsigned short*)ref.data(p) + j0*ref_ls, ref_ls, (const unsigned short*)cmp.data(p) + j0*cmp_ls, cmp_ls, ref.plane_samples(p), j1 - j0);
+		}
+		return kernels::sse(ref.data(p) + j0*ref.linesize(p), ref.linesize(p), cmp.data(p) + j0*cmp.linesize(p), cmp.linesize(p), ref.plane_width(p), j1 - j0);
+	}
+
+	// samples of the first n_planes planes
+	static double n_samples(const qav::frame& f, const int& n_planes) {
+		double	n = 0.0;
+		for(int p = 0; p < n_planes; ++p)
+			n += (double)f.plane_samples(p)*f.plane_height(p);
+		return n;
+	}
+
+	// sums of n adjacent blocks of b_sz x b_sz samples, for the
+	// sizes without a kernel (see get_ssim_sums). Integer sums
+	// are exact (b_sz up to 256, 64 bit sums S for 16 bit samples T)
+	template<typename T, typename S>
+	static void ssim_sums(const T *ref, const int& ref_ls, const T *cmp, const int& cmp_ls, const unsigned int& b_sz, const unsigned int& n, S sums[][5]) {
+		for(unsigned int b = 0; b < n; ++b, ref += b_sz, cmp += b_sz) {
+			S ref_acc = 0;
+			S ref_acc_2 = 0;
+			S cmp_acc = 0;
+			S cmp_acc_2 = 0;
+			S ref_cmp_acc = 0;
+			for(unsigned int j = 0; j < b_sz; ++j)
+				for(unsigned int i = 0; i < b_sz; ++i) {
+					// these are samples of the Y plane
+					const unsigned int	c_ref = ref[j*ref_ls + i],
+								c_cmp = cmp[j*cmp_ls + i];
+					ref_acc += c_ref;
+					ref_acc_2 += (c_ref*c_ref);
+					cmp_acc += c_cmp;
+					cmp_acc_2 += (c_cmp*c_cmp);
+					ref_cmp_acc += (c_ref*c_cmp);
+				}
+			sums[b][0] = ref_acc;
+			sums[b][1] = cmp_acc;
+			sums[b][2] = ref_acc_2;
+			sums[b][3] = cmp_acc_2;
+			sums[b][4] = ref_cmp_acc;
+		}
 	}
 
-	static double compute_ssim(const unsigned char *ref, const unsigned char *cmp, const unsigned int& x, const unsigned int& y, const unsigned int& b_sz) {
-		// we return the average of all the blocks
-		const unsigned int	x_bl_num = x/b_sz,
-					y_bl_num = y/b_sz;
-		if (!x_bl_num || !y_bl_num) return 0.0;
-		std::vector<double>	ssim_accum;
+	struct ssim_sums_size {
+		unsigned int		b_sz;
+		kernels::ssim_sums_fn	*fn;
+		kernels::ssim_sums16_fn	*fn16;
+	};
+
+	// block sizes with their own kernels
+	const ssim_sums_size	ssim_sums_sizes[] = {
+		{ 4, &kernels::ssim_sums_4, &kernels::ssim_sums16_4 },
+		{ 8, &kernels::ssim_sums_8, &kernels::ssim_sums16_8 },
+		{ 16, &kernels::ssim_sums_16, &kernels::ssim_sums16_16 },
+		{ 0, 0, 0 }
+	};
+
+	// kernel for blocks of b_sz x b_sz samples, 0 for the generic loop
+	static kernels::ssim_sums_fn get_ssim_sums(const unsigned int& b_sz) {
+		for(const ssim_sums_size *p = ssim_sums_sizes; p->b_sz; ++p)
+			if (b_sz == p->b_sz) return *p->fn;
+		return 0;
+	}
+
+	// the same for 16 bit samples
+	static kernels::ssim_sums16_fn get_ssim_sums16(const unsigned int& b_sz) {
+		for(const ssim_sums_size *p = ssim_sums_sizes; p->b_sz; ++p)
+			if (b_sz == p->b_sz) return *p->fn16;
+		return 0;
+	}
+
+	// sums of the ssim of the blocks in each block row [yB0, yB1)
+	// into rows[yB]. Block sums are taken a row at a time, with
+	// sums_fn if there's a kernel for b_sz. Samples T have depth
+	// bits, c1 and c2 scale with the peak value
+	template<typename T, typename S>
+	static void compute_ssim(const T *ref, const int& ref_ls, const T *cmp, const int& cmp_ls, const unsigned int& x, const unsigned int& b_sz, void (*sums_fn)(const T*, const int&, const T*, const int&, const unsigned int&, S[][5]), const int& depth, const unsigned int& yB0, const unsigned int& yB1, double *rows) {
+		const unsigned int	x_bl_num = x/b_sz;
+		const double		n_samples = (b_sz*b_sz),
+					peak = ((1 << depth) - 1)/255.0,
+					c1 = 6.5025*peak*peak, // (0.01*255.0)^2
+					c2 = 58.5225*peak*peak; // (0.03*255)^2
+		std::vector<S>		v_sums(5*x_bl_num);
+		S			(*sums)[5] = reinterpret_cast<S (*)[5]>(&v_sums[0]);
 		// for each block do it
-		for(unsigned int yB = 0; yB < y_bl_num; ++yB)
+		for(unsigned int yB = yB0; yB < yB1; ++yB) {
+			const T	*r_ref = ref + yB*b_sz*ref_ls,
+				*r_cmp = cmp + yB*b_sz*cmp_ls;
+			if (sums_fn) sums_fn(r_ref, ref_ls, r_cmp, cmp_ls, x_bl_num, sums);
+			else ssim_sums(r_ref, ref_ls, r_cmp, cmp_ls, b_sz, x_bl_num, sums);
+			double	ssim_accum = 0.0;
 			for(unsigned int xB = 0; xB < x_bl_num; ++xB) {
-				const unsigned int base_offset = xB*b_sz + yB*b_sz*x;
-				double ref_acc = 0.0;
-				double ref_acc_2 = 0.0;
-				double cmp_acc = 0.0;
-				double cmp_acc_2 = 0.0;
-				double ref_cmp_acc = 0.0;
-				for(unsigned int j = 0; j < b_sz; ++j)
-					for(unsigned int i = 0; i < b_sz; ++i) {
-						// we have to multiply by 3, colorplanes are Y Cb Cr, we need
-						// only Y component
-						const unsigned char	c_ref = ref[3*(base_offset + j*x + i)],
-									c_cmp = cmp[3*(base_offset + j*x + i)];
-						ref_acc += c_ref;
-						ref_acc_2 += (c_ref*c_ref);
-						cmp_acc += c_cmp;
-						cmp_acc_2 += (c_cmp*c_cmp);
-						ref_cmp_acc += (c_ref*c_cmp);
-					}
 				// now finally get the ssim for this block
 				// http://en.wikipedia.org/wiki/SSIM
 				// http://en.wikipedia.org/wiki/Variance
 				// http://en.wikipedia.org/wiki/Covariance
-				const double n_samples = (b_sz*b_sz);
-				const double ref_avg = ref_acc/n_samples;
-				const double ref_var = ref_acc_2/n_samples - (ref_avg*ref_avg);
-				const double cmp_avg = cmp_acc/n_samples;
-				const double cmp_var = cmp_acc_2/n_samples - (cmp_avg*cmp_avg);
-				const double ref_cmp_cov = ref_cmp_acc/n_samples - (ref_avg*cmp_avg);
-				const double c1 = 6.5025; // (0.01*255.0)^2
-				const double c2 = 58.5225; // (0.03*255)^2
+				const double ref_avg = sums[xB][0]/n_samples;
+				const double ref_var = sums[xB][2]/n_samples - (ref_avg*ref_avg);
+				const double cmp_avg = sums[xB][1]/n_samples;
+				const double cmp_var = sums[xB][3]/n_samples - (cmp_avg*cmp_avg);
+				const double ref_cmp_cov = sums[xB][4]/n_samples - (ref_avg*cmp_avg);
 				const double ssim_num = (2.0*ref_avg*cmp_avg + c1)*(2.0*ref_cmp_cov + c2);
 				const double ssim_den = (ref_avg*ref_avg + cmp_avg*cmp_avg + c1)*(ref_var + cmp_var + c2);
 				const double ssim = ssim_num/ssim_den;
-				ssim_accum.push_back(ssim);
+				ssim_accum += ssim;
 			}
+			rows[yB] = ssim_accum;
+		}
+	}
 
-		double	avg = 0.0;
-		for(std::vector<double>::const_iterator it = ssim_accum.begin(); it != ssim_accum.end(); ++it)
-			avg += *it;
-		return avg/ssim_accum.size();
+	// ssim of a window from the means, variances and covariance
+	static inline double ssim_window(const double& ref_avg, const double& cmp_avg, const double& ref_var, const double& cmp_var, const double& ref_cmp_cov) {
+		const double c1 = 6.5025; // (0.01*255.0)^2
+		const double c2 = 58.5225; // (0.03*255)^2
+		return ((2.0*ref_avg*cmp_avg + c1)*(2.0*ref_cmp_cov + c2))/((ref_avg*ref_avg + cmp_avg*cmp_avg + c1)*(ref_var + cmp_var + c2));
 	}
 
-	static inline double r_0_1(const double& d) {
-		return std::max(0.0, std::min(1.0, d));
+	// contrast-structure term of the ssim of a window
+	static inline double ssim_cs_window(const double& ref_var, const double& cmp_var, const double& ref_cmp_cov) {
+		const double c2 = 58.5225; // (0.03*255)^2
+		return (2.0*ref_cmp_cov + c2)/(ref_var + cmp_var + c2);
 	}
 
-	static void rgb_2_hsi(unsigned char *p, const int& sz) {
-		/*
-		I = (1/3) *(R+G+B)
-		S = 1 - ( (3/(R+G+B)) * min(R,G,B))
-		H = cos^-1( ((1/2) * ((R-G) + (R - B))) / ((R-G)^2 + (R-B)*(G-B)) ^(1/2) )
-		H = cos^-1 ( (((R-G)+(R-B))/2)/ (sqrt((R-G)^2 + (R-B)*(G-B) )))
-		*/
-		const static double PI = 3.14159265;
-		for(int j =0; j < sz; j += 3) {
-			const double 	r = p[j+0]/255.0,
-					g = p[j+1]/255.0,
-					b = p[j+2]/255.0,
-					i = r_0_1((r+g+b)/3),
-					s = r_0_1(1.0 - (3.0/(r+g+b) * std::min(r, std::min(g, b)))),
-					h = r_0_1(acos(0.5*(r-g + r-b) / sqrt((r-g)*(r-g) + (r-b)*(g-b)))/PI);
-			p[j+0] = 255.0*h + 0.5;
-			p[j+1] = 255.0*s + 0.5;
-			p[j+2] = 255.0*i + 0.5;
+	// ssim with a k x k gaussian window (Wang et al. use k 11, sigma 1.5)
+	// moved by one pixel at a time, over the windows inside the plane.
+	// Separable: every row is filtered horizontally once, the last k
+	// of them are kept and filtered vertically.
+	// The sum of the ssim of each row of windows goes in rows[0 ... y-k]
+	// and, if cs_rows is given, the one of the contrast-structure term.
+	// Samples are 8 bits or, for the ms_ssim scales, float averages
+	// of them (linesizes in samples)
+	template<typename T>
+	static void compute_ssim_gauss(const T *ref, const int& ref_ls, const T *cmp, const int& cmp_ls, const unsigned int& x, const unsigned int& y, const unsigned int& k, const double& sigma, double *rows, double *cs_rows = 0) {
+		if (x < k || y < k) return;
+		const unsigned int	o_x = x - k + 1;
+		std::vector<double>	g(k);
+		double			g_sum = 0.0;
+		for(unsigned int t = 0; t < k; ++t) {
+			const double	d = (double)t - (k - 1)/2.0;
+			g[t] = exp(-d*d/(2.0*sigma*sigma));
+			g_sum += g[t];
+		}
+		for(unsigned int t = 0; t < k; ++t)
+			g[t] /= g_sum;
+		// k rows of horizontally filtered ref, cmp, ref^2, cmp^2, ref*cmp
+		std::vector<double>	h_rows(5*k*o_x),
+					v_row(5*o_x);
+		for(unsigned int j = 0; j < y; ++j) {
+			const T		*r = ref + j*ref_ls,
+					*c = cmp + j*cmp_ls;
+			double		*h = &h_rows[5*(j%k)*o_x];
+			for(unsigned int i = 0; i < o_x; ++i) {
+				double	s_r = 0.0, s_c = 0.0, s_rr = 0.0, s_cc = 0.0, s_rc = 0.0;
+				for(unsigned int t = 0; t < k; ++t) {
+					// products of 8 bit samples are exact either way
+					const double	c_ref = r[i+t],
+							c_cmp = c[i+t];
+					s_r += g[t]*c_ref;
+					s_c += g[t]*c_cmp;
+					s_rr += g[t]*(c_ref*c_ref);
+					s_cc += g[t]*(c_cmp*c_cmp);
+					s_rc += g[t]*(c_ref*c_cmp);
+				}
+				h[i] = s_r;
+				h[o_x + i] = s_c;
+				h[2*o_x + i] = s_rr;
+				h[3*o_x + i] = s_cc;
+				h[4*o_x + i] = s_rc;
+			}
+			if (j + 1 < k) continue;
+			// rows j-k+1 ... j are there, filter them vertically
+			std::fill(v_row.begin(), v_row.end(), 0.0);
+			for(unsigned int t = 0; t < k; ++t) {
+				const double	*h_t = &h_rows[5*((j + 1 + t)%k)*o_x];
+				for(unsigned int i = 0; i < 5*o_x; ++i)
+					v_row[i] += g[t]*h_t[i];
+			}
+			double	ssim_sum = 0.0,
+				cs_sum = 0.0;
+			for(unsigned int i = 0; i < o_x; ++i) {
+				const double	ref_avg = v_row[i],
+						cmp_avg = v_row[o_x + i],
+						ref_var = v_row[2*o_x + i] - ref_avg*ref_avg,
+						cmp_var = v_row[3*o_x + i] - cmp_avg*cmp_avg,
+						ref_cmp_cov = v_row[4*o_x + i] - ref_avg*cmp_avg;
+				ssim_sum += ssim_window(ref_avg, cmp_avg, ref_var, cmp_var, ref_cmp_cov);
+				if (cs_rows) cs_sum += ssim_cs_window(ref_var, cmp_var, ref_cmp_cov);
+			}
+			rows[j + 1 - k] = ssim_sum;
+			if (cs_rows) cs_rows[j + 1 - k] = cs_sum;
+		}
+	}
+
+	// ssim with a k x k box window moved by one pixel at a time.
+	// Sums are kept in integers and slid in both directions, so the
+	// cost per pixel doesn't depend on k (k*k*65025 has to fit in
+	// 32 bits, k <= 256). Sums of each row of windows go in rows[0 ... y-k]
+	static void compute_ssim_box(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& x, const unsigned int& y, const unsigned int& k, double *rows) {
+		if (x < k || y < k) return;
+		const unsigned int		o_x = x - k + 1;
+		// k rows of horizontal window sums and their column sums
+		std::vector<unsigned int>	h_rows(5*k*o_x),
+						col(5*o_x, 0);
+		const double			n_samples = k*k;
+		for(unsigned int j = 0; j < y; ++j) {
+			const unsigned char	*r = ref + j*ref_ls,
+						*c = cmp + j*cmp_ls;
+			unsigned int		*h = &h_rows[5*(j%k)*o_x];
+			// the row leaving the window
+			if (j >= k)
+				for(unsigned int i = 0; i < 5*o_x; ++i)
+					col[i] -= h[i];
+			unsigned int	s_r = 0, s_c = 0, s_rr = 0, s_cc = 0, s_rc = 0;
+			for(unsigned int i = 0; i < x; ++i) {
+				const unsigned int	c_ref = r[i],
+							c_cmp = c[i];
+				s_r += c_ref;
+				s_c += c_cmp;
+				s_rr += c_ref*c_ref;
+				s_cc += c_cmp*c_cmp;
+				s_rc += c_ref*c_cmp;
+				if (i >= k) {
+					const unsigned int	o_ref = r[i-k],
+								o_cmp = c[i-k];
+					s_r -= o_ref;
+					s_c -= o_cmp;
+					s_rr -= o_ref*o_ref;
+					s_cc -= o_cmp*o_cmp;
+					s_rc -= o_ref*o_cmp;
+				}
+				if (i + 1 < k) continue;
+				const unsigned int	o = i + 1 - k;
+				h[o] = s_r;
+				h[o_x + o] = s_c;
+				h[2*o_x + o] = s_rr;
+				h[3*o_x + o] = s_cc;
+				h[4*o_x + o] = s_rc;
+			}
+			for(unsigned int i = 0; i < 5*o_x; ++i)
+				col[i] += h[i];
+			if (j + 1 < k) continue;
+			double	ssim_sum = 0.0;
+			for(unsigned int i = 0; i < o_x; ++i) {
+				const double	ref_avg = col[i]/n_samples,
+						cmp_avg = col[o_x + i]/n_samples;
+				ssim_sum += ssim_window(ref_avg, cmp_avg, col[2*o_x + i]/n_samples - ref_avg*ref_avg, col[3*o_x + i]/n_samples - cmp_avg*cmp_avg, col[4*o_x + i]/n_samples - ref_avg*cmp_avg);
+			}
+			rows[j + 1 - k] = ssim_sum;
 		}
 	}
 
-	static void rgb_2_YCbCr(unsigned char *p, const int& sz) {
-		// http://en.wikipedia.org/wiki/YCbCr
-		for(int j =0; j < sz; j += 3) {
-			const double 	r = p[j+0]/255.0,
-					g = p[j+1]/255.0,
-					b = p[j+2]/255.0;
-			p[j+0] = 16 + (65.481*r + 128.553*g + 24.966*b);
-			p[j+1] = 128 + (-37.797*r - 74.203*g + 112.0*b);
-			p[j+2] = 128 + (112.0*r - 93.786*g - 12.214*b);
+	// ssim of an 8x8 window from its integer sums, constants are
+	// scaled to sums over 64 samples (as in x264)
+	static inline double ssim_end1(const double& s1, const double& s2, const double& ss, const double& s12) {
+		static const double	c1 = (int)(.01*.01*255*255*64 + .5),
+					c2 = (int)(.03*.03*255*255*64*63 + .5);
+		const double	vars = ss*64 - s1*s1 - s2*s2,
+				covar = s12*64 - s1*s2;
+		return (2*s1*s2 + c1)*(2*covar + c2)/((s1*s1 + s2*s2 + c1)*(vars + c2));
+	}
+
+	// ssim on 8x8 windows moved by 4 pixels: sums of 4x4 blocks are
+	// computed once (two at a time by the kernel) and every window is
+	// made of 2x2 neighbouring blocks. Window row w is made of block
+	// rows w and w+1, the sums of window rows [w0, w1) go in w_rows
+	static void compute_ssim_4x4(const unsigned char *ref, const int& ref_ls, const unsigned char *cmp, const int& cmp_ls, const unsigned int& x, const unsigned int& w0, const unsigned int& w1, double *w_rows) {
+		const unsigned int	bw = x/4;
+		if (bw < 2) return;
+		// sums of the current and the previous row of blocks
+		std::vector<int>	v_sums(2*4*bw);
+		int			(*rows[2])[4] = { reinterpret_cast<int (*)[4]>(&v_sums[0]), reinterpret_cast<int (*)[4]>(&v_sums[4*bw]) };
+		for(unsigned int by = w0; by <= w1; ++by) {
+			const unsigned char	*r = ref + 4*by*ref_ls,
+						*c = cmp + 4*by*cmp_ls;
+			int			(*cur)[4] = rows[by%2];
+			unsigned int		bx = 0;
+			for(; bx + 1 < bw; bx += 2)
+				kernels::ssim_4x4x2(r + 4*bx, ref_ls, c + 4*bx, cmp_ls, cur + bx);
+			if (bx < bw) {
+				// last odd block: don't read past the row
+				unsigned char	t_ref[4*8] = { 0 },
+						t_cmp[4*8] = { 0 };
+				int		t_sums[2][4];
+				for(int j = 0; j < 4; ++j)
+					for(int i = 0; i < 4; ++i) {
+						t_ref[j*8 + i] = r[j*ref_ls + 4*bx + i];
+						t_cmp[j*8 + i] = c[j*cmp_ls + 4*bx + i];
+					}
+				kernels::ssim_4x4x2(t_ref, 8, t_cmp, 8, t_sums);
+				for(int i = 0; i < 4; ++i)
+					cur[bx][i] = t_sums[0][i];
+			}
+			if (by == w0) continue;
+			const int	(*prev)[4] = rows[(by+1)%2];
+			double		ssim_sum = 0.0;
+			for(bx = 0; bx + 1 < bw; ++bx)
+				ssim_sum += ssim_end1(prev[bx][0] + prev[bx+1][0] + cur[bx][0] + cur[bx+1][0],
+							prev[bx][1] + prev[bx+1][1] + cur[bx][1] + cur[bx+1][1],
+							prev[bx][2] + prev[bx+1][2] + cur[bx][2] + cur[bx+1][2],
+							prev[bx][3] + prev[bx+1][3] + cur[bx][3] + cur[bx+1][3]);
+			w_rows[by - 1] = ssim_sum;
 		}
 	}
 
-	static void rgb_2_Y(unsigned char *p, const int& sz) {
-		// http://en.wikipedia.org/wiki/YCbCr
-		for(int j =0; j < sz; j += 3) {
-			const double 	r = p[j+0]/255.0,
-					g = p[j+1]/255.0,
-					b = p[j+2]/255.0;
-			p[j+0] = 16 + (65.481*r + 128.553*g + 24.966*b);
-			p[j+1] = 0.0;
-			p[j+2] = 0.0;
+	// halve a plane averaging 2x2 samples, dst is packed. The average
+	// is kept in float: rounding it to 8 bits at every level would pile
+	// up the error down the pyramid
+	template<typename T>
+	static void half_plane(const T *src, const int& src_ls, float *dst, const unsigned int& dst_x, const unsigned int& dst_y) {
+		for(unsigned int j = 0; j < dst_y; ++j) {
+			const T		*s0 = src + 2*j*src_ls,
+					*s1 = s0 + src_ls;
+			float		*d = dst + j*dst_x;
+			for(unsigned int i = 0; i < dst_x; ++i)
+				d[i] = 0.25f*((float)s0[2*i] + s0[2*i+1] + s1[2*i] + s1[2*i+1]);
 		}
 	}
 
-	static int getCPUcount(void) {
-			std::ifstream		cpuinfo("/proc/cpuinfo");
-			std::string		line;
-			std::set<std::string>	IDs;
-			while (cpuinfo){
-				std::getline(cpuinfo,line);
-				if (line.empty())
-						continue;
-				if (line.find("processor") != 0)
-						continue;
-				IDs.insert(line);
-			}
-		if (IDs.empty()) return 1;
-			return IDs.size();
+	// normalized 1D gaussian taps, the outer product of two of
+	// them is fspecial('gaussian', k, sigma)
+	static void gauss_taps(std::vector<float>& g, const unsigned int& k, const double& sigma) {
+		std::vector<double>	d_g(k);
+		double			g_sum = 0.0;
+		for(unsigned int t = 0; t < k; ++t) {
+			const double	d = (double)t - (k - 1)/2.0;
+			d_g[t] = exp(-d*d/(2.0*sigma*sigma));
+			g_sum += d_g[t];
+		}
+		g.resize(k);
+		for(unsigned int t = 0; t < k; ++t)
+			g[t] = d_g[t]/g_sum;
 	}
 
-	static mt::ThreadPool	__stats_tp(getCPUcount());
+	// filter a packed plane x samples wide with the gaussian g ('valid'
+	// region only) and keep one sample out of two in both directions,
+	// the plane needs 2*(d_y-1) + g.size() rows
+	static void vif_downsample(const float *src, const unsigned int& x, const std::vector<float>& g, float *dst, const unsigned int& d_x, const unsigned int& d_y) {
+		const unsigned int	k = g.size();
+		std::vector<float>	v(x);
+		for(unsigned int j = 0; j < d_y; ++j) {
+			std::fill(v.begin(), v.end(), 0.0f);
+			for(unsigned int t = 0; t < k; ++t)
+				kernels::saxpy(&v[0], src + (2*j + t)*x, g[t], x);
+			float	*d = dst + j*d_x;
+			for(unsigned int i = 0; i < d_x; ++i) {
+				float	acc = 0.0f;
+				for(unsigned int t = 0; t < k; ++t)
+					acc += g[t]*v[2*i + t];
+				d[i] = acc;
+			}
+		}
+	}
 
-	class psnr_job : public mt::ThreadPool::Job {
-		const unsigned char	*_ref,
-					*_cmp;
-		const unsigned int	_sz;
-		double			&_res;
+	// vif information terms (Sheikh and Bovik, pixel domain) of the
+	// ow x oh filter positions starting at ox0, oy0 of two packed
+	// planes with linesize ls. Filtering is separable: all the rows
+	// needed are filtered horizontally, then vertically
+	static void vif_tile(const float *ref, const float *cmp, const unsigned int& ls, const unsigned int& ox0, const unsigned int& oy0, const unsigned int& ow, const unsigned int& oh, const std::vector<float>& g, double& num, double& den) {
+		const unsigned int	k = g.size(),
+					iw = ow + k - 1,
+					ih = oh + k - 1;
+		const float		eps = 1e-10f,
+					sigma_nsq = 2.0f;
+		// per row: ref, cmp, ref^2, cmp^2, ref*cmp
+		std::vector<float>	h(5*ih*ow, 0.0f),
+					prod(3*iw),
+					v(5*ow);
+		for(unsigned int r = 0; r < ih; ++r) {
+			const float	*a = ref + (oy0 + r)*ls + ox0,
+					*b = cmp + (oy0 + r)*ls + ox0;
+			for(unsigned int i = 0; i < iw; ++i) {
+				prod[i] = a[i]*a[i];
+				prod[iw + i] = b[i]*b[i];
+				prod[2*iw + i] = a[i]*b[i];
+			}
+			float	*h_r = &h[5*r*ow];
+			for(unsigned int t = 0; t < k; ++t) {
+				kernels::saxpy(h_r, a + t, g[t], ow);
+				kernels::saxpy(h_r + ow, b + t, g[t], ow);
+				kernels::saxpy(h_r + 2*ow, &prod[t], g[t], ow);
+				kernels::saxpy(h_r + 3*ow, &prod[iw + t], g[t], ow);
+				kernels::saxpy(h_r + 4*ow, &prod[2*iw + t], g[t], ow);
+			}
+		}
+		num = den = 0.0;
+		for(unsigned int j = 0; j < oh; ++j) {
+			std::fill(v.begin(), v.end(), 0.0f);
+			for(unsigned int t = 0; t < k; ++t)
+				kernels::saxpy(&v[0], &h[5*(j + t)*ow], g[t], 5*ow);
+			for(unsigned int i = 0; i < ow; ++i) {
+				const float	mu1 = v[i],
+						mu2 = v[ow + i];
+				float		s1 = std::max(0.0f, v[2*ow + i] - mu1*mu1),
+						s2 = std::max(0.0f, v[3*ow + i] - mu2*mu2),
+						s12 = v[4*ow + i] - mu1*mu2,
+						gain = s12/(s1 + eps),
+						sv = s2 - gain*s12;
+				if (s1 < eps) {
+					gain = 0.0f;
+					sv = s2;
+					s1 = 0.0f;
+				}
+				if (s2 < eps) {
+					gain = 0.0f;
+					sv = 0.0f;
+				}
+				if (gain < 0.0f) {
+					sv = s2;
+					gain = 0.0f;
+				}
+				if (sv <= eps) sv = eps;
+				num += log10(1.0 + gain*gain*s1/(sv + sigma_nsq));
+				den += log10(1.0 + s1/sigma_nsq);
+			}
+		}
+	}
+
+	// psnr-hvs(-m) coefficients (Ponomarenko et al.): the csf weights
+	// are 25.73509/Q and the masking ones (10/Q)^2, Q being the jpeg
+	// luma quantization table
+	static const double hvs_csf[64] = {
+		1.608443, 2.339554, 2.573509, 1.608443, 1.072295, 0.643377, 0.504610, 0.421887,
+		2.144591, 2.144591, 1.838221, 1.354478, 0.989811, 0.443708, 0.428918, 0.467911,
+		1.838221, 1.979622, 1.608443, 1.072295, 0.643377, 0.451493, 0.372972, 0.459555,
+		1.838221, 1.513829, 1.169777, 0.887417, 0.504610, 0.295806, 0.321689, 0.415082,
+		1.429727, 1.169777, 0.695543, 0.459555, 0.378457, 0.236102, 0.249855, 0.334222,
+		1.072295, 0.735288, 0.467911, 0.402111, 0.317717, 0.247453, 0.227744, 0.279729,
+		0.525206, 0.402111, 0.329937, 0.295806, 0.249855, 0.212687, 0.214459, 0.254803,
+		0.357432, 0.279729, 0.270896, 0.262603, 0.229778, 0.257351, 0.249855, 0.259950
+	};
+
+	static const double hvs_mask_cof[64] = {
+		0.390625, 0.826446, 1.000000, 0.390625, 0.173611, 0.062500, 0.038447, 0.026874,
+		0.694444, 0.694444, 0.510204, 0.277008, 0.147929, 0.029727, 0.027778, 0.033058,
+		0.510204, 0.591716, 0.390625, 0.173611, 0.062500, 0.030779, 0.021004, 0.031888,
+		0.510204, 0.346021, 0.206612, 0.118906, 0.038447, 0.013212, 0.015625, 0.026015,
+		0.308642, 0.206612, 0.073046, 0.031888, 0.021626, 0.008417, 0.009426, 0.016866,
+		0.173611, 0.081633, 0.033058, 0.024414, 0.015242, 0.009246, 0.007831, 0.011891,
+		0.041649, 0.024414, 0.016437, 0.013212, 0.009426, 0.006830, 0.006944, 0.009803,
+		0.019290, 0.011891, 0.011061, 0.010412, 0.007972, 0.010000, 0.009426, 0.010203
+	};
+
+	// n*var of n samples (matlab's var, n-1 normalized) from their sums
+	static inline double hvs_vari(const int& n, const long long& s, const long long& ss) {
+		return (double)(n*ss - s*s)/(n - 1);
+	}
+
+	// masking of an 8x8 block from its samples and its dct
+	static double hvs_mask(const unsigned char *p, const int& ls, const float *dct) {
+		double	m = 0.0;
+		for(int i = 1; i < 64; ++i)
+			m += (double)dct[i]*dct[i]*hvs_mask_cof[i];
+		// sums of the 4x4 quarters
+		long long	s[4] = { 0 },
+				ss[4] = { 0 };
+		for(int j = 0; j < 8; ++j)
+			for(int i = 0; i < 8; ++i) {
+				const int	q = 2*(j/4) + i/4,
+						v = p[j*ls + i];
+				s[q] += v;
+				ss[q] += v*v;
+			}
+		double	pop = hvs_vari(64, s[0] + s[1] + s[2] + s[3], ss[0] + ss[1] + ss[2] + ss[3]);
+		if (pop != 0.0)
+			pop = (hvs_vari(16, s[0], ss[0]) + hvs_vari(16, s[1], ss[1]) + hvs_vari(16, s[2], ss[2]) + hvs_vari(16, s[3], ss[3]))/pop;
+		return sqrt(m*pop)/32.0;
+	}
+
+	// adds the csf weighted squared dct differences of a block, as is
+	// (psnr-hvs) and after masking (psnr-hvs-m)
+	static void hvs_block(const float *a_dct, const double& a_mask, const float *b_dct, const double& b_mask, double& s_hvs, double& s_hvsm) {
+		const double	mask = std::max(a_mask, b_mask);
+		for(int i = 0; i < 64; ++i) {
+			double	u = fabs((double)a_dct[i] - b_dct[i]);
+			s_hvs += (u*hvs_csf[i])*(u*hvs_csf[i]);
+			if (i) {
+				const double	thr = mask/hvs_mask_cof[i];
+				u = (u < thr) ? 0.0 : u - thr;
+			}
+			s_hvsm += (u*hvs_csf[i])*(u*hvs_csf[i]);
+		}
+	}
+
+	// created on first use, once main has set the share of the cores
+	// left to the analyzers
+	static mt::TaskPool& stats_tp(void) {
+		static mt::TaskPool	tp((settings::STATS_THREADS > 0) ? settings::STATS_THREADS : mt::get_cpu_count());
+		return tp;
+	}
+
+	// number of row bands the work of each stream is split in: a few
+	// jobs per thread of the pool, so that even a single stream uses
+	// all the cores, but no bands thinner than min_rows. Partial results
+	// are either exact (sse) or kept per row and added in order, so
+	// they don't depend on the number of bands
+	static unsigned int n_bands(const unsigned int& rows, const std::vector<bool>& v_ok, const unsigned int& min_rows) {
+		const unsigned int	n_streams = std::max(1, (int)std::count(v_ok.begin(), v_ok.end(), true)),
+					per_stream = (4*stats_tp().n_execs() + n_streams - 1)/n_streams,
+					max_bands = std::max(1U, rows/std::max(1U, min_rows));
+		return std::min(per_stream, max_bands);
+	}
+
+	// rows[0] + ... + rows[n-1], in this order, over n_windows
+	static double rows_mean(const double *rows, const unsigned int& n, const double& n_windows) {
+		double	sum = 0.0;
+		for(unsigned int i = 0; i < n; ++i)
+			sum += rows[i];
+		return sum/n_windows;
+	}
+
+	class psnr_job : public mt::Task {
+		const qav::frame	&_ref,
+					&_cmp;
+		const int		_n_planes;
+		const unsigned int	_b,
+					_n_bands;
+		const bool		_hsi;
+		unsigned long long	&_sse;
+
+		// cmp is converted one row at a time in a buffer that
+		// stays in cache, and compared right away
+		unsigned long long hsi_sse(void) {
+			const unsigned int		w = _ref.plane_width(0),
+							j0 = band_row(_ref.plane_height(0), _b, _n_bands),
+							j1 = band_row(_ref.plane_height(0), _b+1, _n_bands);
+			std::vector<unsigned char>	row(w);
+			unsigned long long		sse = 0;
+			for(unsigned int j = j0; j < j1; ++j) {
+				kernels::rgb_2_hsi(_cmp.data(0) + j*_cmp.linesize(0), &row[0], w);
+				sse += kernels::sse(_ref.data(0) + j*_ref.linesize(0), _ref.linesize(0), &row[0], w, w, 1);
+			}
+			return sse;
+		}
 	public:
-		psnr_job(const unsigned char *ref, const unsigned char *cmp, const unsigned int& sz, double& res) :
-		_ref(ref), _cmp(cmp), _sz(sz), _res(res) {
+		psnr_job(const qav::frame& ref, const qav::frame& cmp, const int& n_planes, const unsigned int& b, const unsigned int& n_bands, const bool& hsi, unsigned long long& sse) :
+		_ref(ref), _cmp(cmp), _n_planes(n_planes), _b(b), _n_bands(n_bands), _hsi(hsi), _sse(sse) {
 		}
 
 		virtual void run(void) {
-			_res = compute_psnr(_ref, _cmp, _sz);
+			if (_hsi) {
+				_sse = hsi_sse();
+				return;
+			}
+			_sse = 0;
+			for(int p = 0; p < _n_planes; ++p)
+				_sse += compute_sse(_ref, _cmp, p, _b, _n_bands);
 		}
 	};
 
-	static void get_psnr_tp(const VUCHAR& ref, const std::vector<bool>& v_ok, const std::vector<VUCHAR>& streams, std::vector<double>& res) {
-		const unsigned int 			sz = v_ok.size();
+	// psnr over the first n_planes planes. With hsi set, ref has to be
+	// already in hsi while the streams are converted on the fly
+	static void get_psnr_tp(const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams, std::vector<double>& res, const int& n_planes, const bool& hsi = false) {
+		const unsigned int 			sz = v_ok.size(),
+							n = n_bands(ref.plane_height(0), v_ok, 16);
+		std::vector<unsigned long long>		v_sse(sz*n);
 		std::vector<shared_ptr<psnr_job> >	v_jobs;
+		mt::TaskGroup				tg(stats_tp());
 		for(unsigned int i =0; i < sz; ++i) {
-			if (v_ok[i]) {
-				v_jobs.push_back(new psnr_job(&ref[0], &(streams[i][0]), ref.size(), res[i]));
-				__stats_tp.add(v_jobs.rbegin()->get());
-			} else res[i] = 0.0;
+			if (!v_ok[i]) continue;
+			for(unsigned int b = 0; b < n; ++b) {
+				v_jobs.push_back(new psnr_job(ref, streams[i], n_planes, b, n, hsi, v_sse[i*n + b]));
+				tg.add(v_jobs.rbegin()->get());
+			}
 		}
 		//wait for all
-		for(std::vector<shared_ptr<psnr_job> >::iterator it = v_jobs.begin(); it != v_jobs.end(); ++it) {
-			(*it)->wait();
-			(*it) = 0;
+		tg.wait();
+		for(unsigned int i =0; i < sz; ++i) {
+			unsigned long long	sse = 0;
+			for(unsigned int b = 0; b < n; ++b)
+				sse += v_sse[i*n + b];
+			res[i] = v_ok[i] ? sse_2_psnr(sse, n_samples(ref, n_planes), ref.depth()) : 0.0;
 		}
 	}
 
-	class ssim_job : public mt::ThreadPool::Job {
-		const unsigned char	*_ref,
-					*_cmp;
-		const unsigned int	_x,
-					_y,
-					_b_sz;
-		double			&_res;
+	class plane_psnr_job : public mt::Task {
+		const qav::frame	&_ref,
+					&_cmp;
+		const unsigned int	_b,
+					_n_bands;
+		unsigned long long	*_sse;
 	public:
-		ssim_job(const unsigned char *ref, const unsigned char *cmp, const unsigned int& x, const unsigned int& y, const unsigned int b_sz, double& res) :
-		_ref(ref), _cmp(cmp), _x(x), _y(y), _b_sz(b_sz), _res(res) {
+		plane_psnr_job(const qav::frame& ref, const qav::frame& cmp, const unsigned int& b, const unsigned int& n_bands, unsigned long long *sse) :
+		_ref(ref), _cmp(cmp), _b(b), _n_bands(n_bands), _sse(sse) {
 		}
 
 		virtual void run(void) {
-			_res = compute_ssim(_ref, _cmp, _x, _y, _b_sz);
+			// all the planes of the band in the same job
+			for(int p = 0; p < _ref.n_planes(); ++p)
+				_sse[p] = compute_sse(_ref, _cmp, p, _b, _n_bands);
 		}
 	};
 
-	static void get_ssim_tp(const VUCHAR& ref, const std::vector<bool>& v_ok, const std::vector<VUCHAR>& streams, std::vector<double>& res, const unsigned int& x, const unsigned int& y, const unsigned int& b_sz) {
-		const unsigned int 			sz = v_ok.size();
-		std::vector<shared_ptr<ssim_job> >	v_jobs;
+	// res has 3 values (Y, Cb, Cr) for each stream
+	static void get_plane_psnr_tp(const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams, std::vector<double>& res) {
+		const unsigned int 				sz = v_ok.size(),
+								n = n_bands(ref.plane_height(0), v_ok, 16);
+		std::vector<unsigned long long>			v_sse(3*sz*n);
+		std::vector<shared_ptr<plane_psnr_job> >	v_jobs;
+		mt::TaskGroup					tg(stats_tp());
 		for(unsigned int i =0; i < sz; ++i) {
-			if (v_ok[i]) {
-				v_jobs.push_back(new ssim_job(&ref[0], &(streams[i][0]), x, y, b_sz, res[i]));
-				__stats_tp.add(v_jobs.rbegin()->get());
-			} else res[i] = 0.0;
+			if (!v_ok[i]) continue;
+			for(unsigned int b = 0; b < n; ++b) {
+				v_jobs.push_back(new plane_psnr_job(ref, streams[i], b, n, &v_sse[3*(i*n + b)]));
+				tg.add(v_jobs.rbegin()->get());
+			}
 		}
 		//wait for all
-		for(std::vector<shared_ptr<ssim_job> >::iterator it = v_jobs.begin(); it != v_jobs.end(); ++it) {
-			(*it)->wait();
-			(*it) = 0;
-		}
+		tg.wait();
+		for(unsigned int i =0; i < sz; ++i)
+			for(int p = 0; p < 3; ++p) {
+				unsigned long long	sse = 0;
+				for(unsigned int b = 0; b < n; ++b)
+					sse += v_sse[3*(i*n + b) + p];
+				res[3*i + p] = v_ok[i] ? sse_2_psnr(sse, (double)ref.plane_samples(p)*ref.plane_height(p), ref.depth()) : 0.0;
+			}
 	}
 
-	class hsi_job : public mt::ThreadPool::Job {
-		unsigned char		*_buf;
-		const unsigned int	_sz;
+	class ssim_job : public mt::Task {
+		const qav::frame	&_ref,
+					&_cmp;
+		const unsigned int	_x,
+					_b_sz,
+					_yB0,
+					_yB1;
+		const kernels::ssim_sums_fn	_sums_fn;
+		const kernels::ssim_sums16_fn	_sums16_fn;
+		double			*_rows;
 	public:
-		hsi_job(unsigned char *buf, const unsigned int& sz) :
-		_buf(buf), _sz(sz) {
+		ssim_job(const qav::frame& ref, const qav::frame& cmp, const unsigned int& x, const unsigned int b_sz, const kernels::ssim_sums_fn& sums_fn, const kernels::ssim_sums16_fn& sums16_fn, const unsigned int& yB0, const unsigned int& yB1, double *rows) :
+		_ref(ref), _cmp(cmp), _x(x), _b_sz(b_sz), _yB0(yB0), _yB1(yB1), _sums_fn(sums_fn), _sums16_fn(sums16_fn), _rows(rows) {
 		}
 
 		virtual void run(void) {
-			rgb_2_hsi(_buf, _sz);
+			if (2 == _ref.sample_bytes())
+				compute_ssim((const unsigned short*)_ref.data(0), _ref.linesize(0)/2, (const unsigned short*)_cmp.data(0), _cmp.linesize(0)/2, _x, _b_sz, _sums16_fn, _ref.depth(), _yB0, _yB1, _rows);
+			else compute_ssim(_ref.data(0), _ref.linesize(0), _cmp.data(0), _cmp.linesize(0), _x, _b_sz, _sums_fn, 8, _yB0, _yB1, _rows);
 		}
 	};
 
-	class YCbCr_job : public mt::ThreadPool::Job {
-		unsigned char		*_buf;
-		const unsigned int	_sz;
+	// ssim is computed on the Y plane only
+	static void get_ssim_tp(const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams, std::vector<double>& res, const unsigned int& x, const unsigned int& y, const unsigned int& b_sz, const kernels::ssim_sums_fn& sums_fn, const kernels::ssim_sums16_fn& sums16_fn) {
+		const unsigned int 			sz = v_ok.size(),
+							x_bl_num = x/b_sz,
+							y_bl_num = y/b_sz;
+		if (!x_bl_num || !y_bl_num) {
+			std::fill(res.begin(), res.end(), 0.0);
+			return;
+		}
+		const unsigned int			n = n_bands(y_bl_num, v_ok, std::max(1U, 16/b_sz));
+		std::vector<double>			v_rows(sz*y_bl_num);
+		std::vector<shared_ptr<ssim_job> >	v_jobs;
+		mt::TaskGroup				tg(stats_tp());
+		for(unsigned int i =0; i < sz; ++i) {
+			if (!v_ok[i]) continue;
+			for(unsigned int b = 0; b < n; ++b) {
+				v_jobs.push_back(new ssim_job(ref, streams[i], x, b_sz, sums_fn, sums16_fn, band_row(y_bl_num, b, n), band_row(y_bl_num, b+1, n), &v_rows[i*y_bl_num]));
+				tg.add(v_jobs.rbegin()->get());
+			}
+		}
+		//wait for all
+		tg.wait();
+		for(unsigned int i =0; i < sz; ++i)
+			res[i] = v_ok[i] ? rows_mean(&v_rows[i*y_bl_num], y_bl_num, (double)x_bl_num*y_bl_num) : 0.0;
+	}
+
+	// rows of windows [o0, o1) of the Y plane
+	class sliding_ssim_job : public mt::Task {
+		const qav::frame	&_ref,
+					&_cmp;
+		const bool		_is_box;
+		const unsigned int	_k,
+					_o0,
+					_o1;
+		double			*_rows;
 	public:
-		YCbCr_job(unsigned char *buf, const unsigned int& sz) :
-		_buf(buf), _sz(sz) {
+		sliding_ssim_job(const qav::frame& ref, const qav::frame& cmp, const bool& is_box, const unsigned int& k, const unsigned int& o0, const unsigned int& o1, double *rows) :
+		_ref(ref), _cmp(cmp), _is_box(is_box), _k(k), _o0(o0), _o1(o1), _rows(rows) {
 		}
 
 		virtual void run(void) {
-			rgb_2_YCbCr(_buf, _sz);
+			const unsigned char	*r = _ref.data(0) + _o0*_ref.linesize(0),
+						*c = _cmp.data(0) + _o0*_cmp.linesize(0);
+			const unsigned int	y = _o1 - _o0 + _k - 1;
+			if (_is_box) compute_ssim_box(r, _ref.linesize(0), c, _cmp.linesize(0), _ref.width(), y, _k, _rows + _o0);
+			else compute_ssim_gauss(r, _ref.linesize(0), c, _cmp.linesize(0), _ref.width(), y, _k, 1.5, _rows + _o0);
 		}
 	};
 
-	class Y_job : public mt::ThreadPool::Job {
-		unsigned char		*_buf;
-		const unsigned int	_sz;
+	static void get_sliding_ssim_tp(const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams, std::vector<double>& res, const bool& is_box, const unsigned int& k) {
+		const unsigned int 				sz = v_ok.size();
+		if ((unsigned int)ref.width() < k || (unsigned int)ref.height() < k) {
+			std::fill(res.begin(), res.end(), 0.0);
+			return;
+		}
+		// bands overlap by k-1 rows, keep them a few windows high
+		const unsigned int				o_x = ref.width() - k + 1,
+								o_y = ref.height() - k + 1,
+								n = n_bands(o_y, v_ok, 4*k);
+		std::vector<double>				v_rows(sz*o_y);
+		std::vector<shared_ptr<sliding_ssim_job> >	v_jobs;
+		mt::TaskGroup					tg(stats_tp());
+		for(unsigned int i =0; i < sz; ++i) {
+			if (!v_ok[i]) continue;
+			for(unsigned int b = 0; b < n; ++b) {
+				v_jobs.push_back(new sliding_ssim_job(ref, streams[i], is_box, k, band_row(o_y, b, n), band_row(o_y, b+1, n), &v_rows[i*o_y]));
+				tg.add(v_jobs.rbegin()->get());
+			}
+		}
+		//wait for all
+		tg.wait();
+		for(unsigned int i =0; i < sz; ++i)
+			res[i] = v_ok[i] ? rows_mean(&v_rows[i*o_y], o_y, (double)o_x*o_y) : 0.0;
+	}
+
+	// rows of windows [w0, w1) of the Y plane
+	class fast_ssim_job : public mt::Task {
+		const qav::frame	&_ref,
+					&_cmp;
+		const unsigned int	_w0,
+					_w1;
+		double			*_rows;
 	public:
-		Y_job(unsigned char *buf, const unsigned int& sz) :
-		_buf(buf), _sz(sz) {
+		fast_ssim_job(const qav::frame& ref, const qav::frame& cmp, const unsigned int& w0, const unsigned int& w1, double *rows) :
+		_ref(ref), _cmp(cmp), _w0(w0), _w1(w1), _rows(rows) {
 		}
 
 		virtual void run(void) {
-			rgb_2_Y(_buf, _sz);
+			compute_ssim_4x4(_ref.data(0), _ref.linesize(0), _cmp.data(0), _cmp.linesize(0), _ref.width(), _w0, _w1, _rows);
 		}
 	};
 
-	static void rgb_2_hsi_tp(VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
-		const unsigned int 			sz = v_ok.size();
-		std::vector<shared_ptr<hsi_job> >	v_jobs;
-		v_jobs.push_back(new hsi_job(&ref[0], ref.size()));
-		__stats_tp.add(v_jobs.rbegin()->get());
+	static void get_fast_ssim_tp(const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams, std::vector<double>& res) {
+		const unsigned int 			sz = v_ok.size(),
+							bw = ref.width()/4,
+							bh = ref.height()/4;
+		if (bw < 2 || bh < 2) {
+			std::fill(res.begin(), res.end(), 0.0);
+			return;
+		}
+		const unsigned int			n = n_bands(bh - 1, v_ok, 4);
+		std::vector<double>			v_rows(sz*(bh - 1));
+		std::vector<shared_ptr<fast_ssim_job> >	v_jobs;
+		mt::TaskGroup				tg(stats_tp());
 		for(unsigned int i =0; i < sz; ++i) {
-			if (v_ok[i]) {
-				v_jobs.push_back(new hsi_job(&(streams[i][0]), streams[i].size()));
-				__stats_tp.add(v_jobs.rbegin()->get());
+			if (!v_ok[i]) continue;
+			for(unsigned int b = 0; b < n; ++b) {
+				v_jobs.push_back(new fast_ssim_job(ref, streams[i], band_row(bh - 1, b, n), band_row(bh - 1, b+1, n), &v_rows[i*(bh - 1)]));
+				tg.add(v_jobs.rbegin()->get());
 			}
 		}
 		//wait for all
-		for(std::vector<shared_ptr<hsi_job> >::iterator it = v_jobs.begin(); it != v_jobs.end(); ++it) {
-			(*it)->wait();
-			(*it) = 0;
-		}
+		tg.wait();
+		for(unsigned int i =0; i < sz; ++i)
+			res[i] = v_ok[i] ? rows_mean(&v_rows[i*(bh - 1)], bh - 1, (double)(bw - 1)*(bh - 1)) : 0.0;
 	}
 
-	static void rgb_2_YCbCr_tp(VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
-		const unsigned int 			sz = v_ok.size();
-		std::vector<shared_ptr<YCbCr_job> >	v_jobs;
-		v_jobs.push_back(new YCbCr_job(&ref[0], ref.size()));
-		__stats_tp.add(v_jobs.rbegin()->get());
-		for(unsigned int i =0; i < sz; ++i) {
-			if (v_ok[i]) {
-				v_jobs.push_back(new YCbCr_job(&(streams[i][0]), streams[i].size()));
-				__stats_tp.add(v_jobs.rbegin()->get());
-			}
+	// builds levels 1 ... n of a dyadic pyramid of the Y plane
+	class pyramid_job : public mt::Task {
+		const qav::frame		&_frame;
+		std::vector<float>		*_levels;
+		const unsigned int		*_x,
+						*_y,
+						_n;
+	public:
+		pyramid_job(const qav::frame& frame, std::vector<float> *levels, const unsigned int *x, const unsigned int *y, const unsigned int& n) :
+		_frame(frame), _levels(levels), _x(x), _y(y), _n(n) {
 		}
-		//wait for all
-		for(std::vector<shared_ptr<YCbCr_job> >::iterator it = v_jobs.begin(); it != v_jobs.end(); ++it) {
-			(*it)->wait();
-			(*it) = 0;
+
+		virtual void run(void) {
+			half_plane(_frame.data(0), _frame.linesize(0), &_levels[0][0], _x[1], _y[1]);
+			for(unsigned int l = 1; l < _n; ++l)
+				half_plane(&_levels[l-1][0], _x[l], &_levels[l][0], _x[l+1], _y[l+1]);
 		}
-	}
+	};
 
-	static void rgb_2_Y_tp(VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
-		const unsigned int 			sz = v_ok.size();
-		std::vector<shared_ptr<Y_job> >		v_jobs;
-		v_jobs.push_back(new Y_job(&ref[0], ref.size()));
-		__stats_tp.add(v_jobs.rbegin()->get());
-		for(unsigned int i =0; i < sz; ++i) {
-			if (v_ok[i]) {
-				v_jobs.push_back(new Y_job(&(streams[i][0]), streams[i].size()));
-				__stats_tp.add(v_jobs.rbegin()->get());
+	// rows of windows [o0, o1) of one scale, the first one is 8 bits
+	// and the halved ones float
+	template<typename T>
+	class ms_ssim_job : public mt::Task {
+		const T			*_ref,
+					*_cmp;
+		const int		_ref_ls,
+					_cmp_ls;
+		const unsigned int	_x,
+					_o0,
+					_o1;
+		double			*_rows,
+					*_cs_rows;
+	public:
+		ms_ssim_job(const T *ref, const int& ref_ls, const T *cmp, const int& cmp_ls, const unsigned int& x, const unsigned int& o0, const unsigned int& o1, double *rows, double *cs_rows) :
+		_ref(ref), _cmp(cmp), _ref_ls(ref_ls), _cmp_ls(cmp_ls), _x(x), _o0(o0), _o1(o1), _rows(rows), _cs_rows(cs_rows) {
+		}
+
+		virtual void run(void) {
+			compute_ssim_gauss(_ref + _o0*_ref_ls, _ref_ls, _cmp + _o0*_cmp_ls, _cmp_ls, _x, _o1 - _o0 + 10, 11, 1.5, _rows + _o0, _cs_rows + _o0);
+		}
+	};
+
+	// float copy of the Y plane and the vif scales below it
+	class vif_pyramid_job : public mt::Task {
+		const qav::frame		&_frame;
+		std::vector<float>		*_levels;
+		const unsigned int		*_x,
+						*_y;
+		const std::vector<float>	*_g;
+		const unsigned int		_n;
+	public:
+		vif_pyramid_job(const qav::frame& frame, std::vector<float> *levels, const unsigned int *x, const unsigned int *y, const std::vector<float> *g, const unsigned int& n) :
+		_frame(frame), _levels(levels), _x(x), _y(y), _g(g), _n(n) {
+		}
+
+		virtual void run(void) {
+			float	*l0 = &_levels[0][0];
+			for(unsigned int j = 0; j < _y[0]; ++j) {
+				const unsigned char	*p = _frame.data(0) + j*_frame.linesize(0);
+				for(unsigned int i = 0; i < _x[0]; ++i)
+					l0[j*_x[0] + i] = p[i];
 			}
+			for(unsigned int s = 1; s < _n; ++s)
+				vif_downsample(&_levels[s-1][0], _x[s-1], _g[s], &_levels[s][0], _x[s], _y[s]);
 		}
-		//wait for all
-		for(std::vector<shared_ptr<Y_job> >::iterator it = v_jobs.begin(); it != v_jobs.end(); ++it) {
-			(*it)->wait();
-			(*it) = 0;
+	};
+
+	class vif_tile_job : public mt::Task {
+		const float			*_ref,
+						*_cmp;
+		const unsigned int		_ls,
+						_ox0,
+						_oy0,
+						_ow,
+						_oh;
+		const std::vector<float>	&_g;
+		double				&_num,
+						&_den;
+	public:
+		vif_tile_job(const float *ref, const float *cmp, const unsigned int& ls, const unsigned int& ox0, const unsigned int& oy0, const unsigned int& ow, const unsigned int& oh, const std::vector<float>& g, double& num, double& den) :
+		_ref(ref), _cmp(cmp), _ls(ls), _ox0(ox0), _oy0(oy0), _ow(ow), _oh(oh), _g(g), _num(num), _den(den) {
+		}
+
+		virtual void run(void) {
+			vif_tile(_ref, _cmp, _ls, _ox0, _oy0, _ow, _oh, _g, _num, _den);
 		}
+	};
+
+	// dct and masking of the reference blocks in rows [by0, by1)
+	class hvs_ref_job : public mt::Task {
+		const qav::frame	&_ref;
+		const unsigned int	_bw,
+					_by0,
+					_by1;
+		float			*_dct;
+		double			*_mask;
+	public:
+		hvs_ref_job(const qav::frame& ref, const unsigned int& bw, const unsigned int& by0, const unsigned int& by1, float *dct, double *mask) :
+		_ref(ref), _bw(bw), _by0(by0), _by1(by1), _dct(dct), _mask(mask) {
+		}
+
+		virtual void run(void) {
+			for(unsigned int by = _by0; by < _by1; ++by)
+				for(unsigned int bx = 0; bx < _bw; ++bx) {
+					const unsigned char	*p = _ref.data(0) + 8*by*_ref.linesize(0) + 8*bx;
+					float			*dct = _dct + 64*(by*_bw + bx);
+					kernels::fdct8x8(p, _ref.linesize(0), dct);
+					_mask[by*_bw + bx] = hvs_mask(p, _ref.linesize(0), dct);
+				}
+		}
+	};
+
+	// psnr-hvs(-m) sums of a stream's blocks in rows [by0, by1)
+	class hvs_job : public mt::Task {
+		const float		*_ref_dct;
+		const double		*_ref_mask;
+		const qav::frame	&_cmp;
+		const unsigned int	_bw,
+					_by0,
+					_by1;
+		double			&_s_hvs,
+					&_s_hvsm;
+	public:
+		hvs_job(const float *ref_dct, const double *ref_mask, const qav::frame& cmp, const unsigned int& bw, const unsigned int& by0, const unsigned int& by1, double& s_hvs, double& s_hvsm) :
+		_ref_dct(ref_dct), _ref_mask(ref_mask), _cmp(cmp), _bw(bw), _by0(by0), _by1(by1), _s_hvs(s_hvs), _s_hvsm(s_hvsm) {
+		}
+
+		virtual void run(void) {
+			float	dct[64];
+			_s_hvs = _s_hvsm = 0.0;
+			for(unsigned int by = _by0; by < _by1; ++by)
+				for(unsigned int bx = 0; bx < _bw; ++bx) {
+					const unsigned char	*p = _cmp.data(0) + 8*by*_cmp.linesize(0) + 8*bx;
+					const unsigned int	b = by*_bw + bx;
+					kernels::fdct8x8(p, _cmp.linesize(0), dct);
+					hvs_block(_ref_dct + 64*b, _ref_mask[b], dct, hvs_mask(p, _cmp.linesize(0), dct), _s_hvs, _s_hvsm);
+				}
+		}
+	};
+
+	// rows [j0, j1) of a frame to another one
+	class hsi_job : public mt::Task {
+		const qav::frame	&_src;
+		qav::frame		&_dst;
+		const unsigned int	_j0,
+					_j1;
+	public:
+		hsi_job(const qav::frame& src, qav::frame& dst, const unsigned int& j0, const unsigned int& j1) :
+		_src(src), _dst(dst), _j0(j0), _j1(j1) {
+		}
+
+		virtual void run(void) {
+			// rows can be padded, convert them one by one
+			for(unsigned int j = _j0; j < _j1; ++j)
+				kernels::rgb_2_hsi(_src.data(0) + j*_src.linesize(0), _dst.data(0) + j*_dst.linesize(0), _src.plane_width(0));
+		}
+	};
+
+	// dst has to be allocated with the same size as src
+	static void rgb_2_hsi_tp(const qav::frame& src, qav::frame& dst, const std::vector<bool>& v_ok) {
+		const unsigned int 			h = src.plane_height(0),
+							n = n_bands(h, v_ok, 16);
+		std::vector<shared_ptr<hsi_job> >	v_jobs;
+		mt::TaskGroup				tg(stats_tp());
+		for(unsigned int b = 0; b < n; ++b) {
+			v_jobs.push_back(new hsi_job(src, dst, band_row(h, b, n), band_row(h, b+1, n)));
+			tg.add(v_jobs.rbegin()->get());
+		}
+		//wait for all
+		tg.wait();
 	}
 
+	// hsi conversion of the reference
+	struct hsi_entry : public frame_cache::entry {
+		qav::frame	ref;
+	};
+
 	class psnr : public s_base {
 		std::string	_colorspace;
 	protected:
 		void print(const int& ref_frame, const std::vector<double>& v_res) {
 			
 			for(int i = 0; i < _n_streams; ++i)
-				_ostr << "d" << i << ".push([" << ref_frame << ", " << v_res[i] << "]);" << std::endl;
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << v_res[i] << "]);" << std::endl;
 			/*_ostr << ref_frame << ',';
 			for(int i = 0; i < _n_streams; ++i)
 				_ostr << v_res[i] << ',';
 			_ostr << std::endl;*/
 		}
 
-		void process_colorspace(VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
+		// rgb and hsi are packed in a single plane
+		int n_planes(void) const {
+			return (_colorspace == "ycbcr") ? 3 : 1;
+		}
+
+		// "ycbcr" and "y" are read straight from the planar frames.
+		// Frames are never modified: for "hsi" the reference is
+		// converted once in the frame_cache, the streams while
+		// computing the psnr
+		void compute(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams, std::vector<double>& v_res) {
 			if (_colorspace == "hsi") {
-				rgb_2_hsi_tp(ref, v_ok, streams);
-			} else if (_colorspace == "ycbcr") {
-				rgb_2_YCbCr_tp(ref, v_ok, streams);
-			} else if (_colorspace == "y") {
-				rgb_2_Y_tp(ref, v_ok, streams);
-			}
+				hsi_entry	&hsi = _cache->get<hsi_entry>("hsi_ref");
+				if (!hsi.valid(ref_frame)) {
+					hsi.ref.alloc(qav::PL_RGB24, ref.width(), ref.height());
+					rgb_2_hsi_tp(ref, hsi.ref, v_ok);
+					hsi.set_valid(ref_frame);
+				}
+				get_psnr_tp(hsi.ref, v_ok, streams, v_res, 1, true);
+			} else get_psnr_tp(ref, v_ok, streams, v_res, n_planes());
 		}
 	public:
 		psnr(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
@@ -350,16 +1030,26 @@ namespace stats {
 				if (_colorspace != "rgb" && _colorspace != "hsi"
 				&& _colorspace != "ycbcr" && _colorspace != "y")
 					throw std::runtime_error("Invalid colorspace passed to analyzer");
+				// build the tables now, not in the first jobs
+				if (_colorspace == "hsi") kernels::get_hsi_tables();
 			}
 		}
 
-		virtual void process(const int& ref_frame, VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
+		virtual qav::pix_layout get_layout(void) const {
+			if (_colorspace == "y" || _colorspace == "ycbcr") return qav::PL_YUV420P;
+			return qav::PL_RGB24;
+		}
+
+		// rgb and hsi are 8 bits
+		virtual bool high_depth(void) const {
+			return qav::PL_YUV420P == get_layout();
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
 			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
-			// process colorspace
-			process_colorspace(ref, v_ok, streams);
 			//
 			std::vector<double>	v_res(_n_streams);
-			get_psnr_tp(ref, v_ok, streams, v_res);
+			compute(ref_frame, ref, v_ok, streams, v_res);
 			//
 			print(ref_frame, v_res);
 		}
@@ -397,15 +1087,13 @@ namespace stats {
 			}
 		}
 
-		virtual void process(const int& ref_frame, VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
 			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
 			// set last frame
 			_last_frame = ref_frame;
-			// process colorspace
-			process_colorspace(ref, v_ok, streams);
 			// compute the psnr
 			std::vector<double>	v_res(_n_streams);
-			get_psnr_tp(ref, v_ok, streams, v_res);
+			compute(ref_frame, ref, v_ok, streams, v_res);
 			// accumulate for each
 			for(int i = 0; i < _n_streams; ++i) {
 				if (v_ok[i]) {
@@ -429,13 +1117,71 @@ namespace stats {
 		}
 	};
 
+	// psnr of the Y, Cb and Cr planes (at their own resolution)
+	// plus their weighted average, default 6:1:1
+	class plane_psnr : public s_base {
+		double	_weights[3];
+	public:
+		plane_psnr(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
+		s_base(n_streams, i_width, i_height, ostr) {
+			_weights[0] = 6.0;
+			_weights[1] = 1.0;
+			_weights[2] = 1.0;
+		}
+
+		virtual void set_parameter(const std::string& p_name, const std::string& p_value) {
+			if (p_name == "weights") {
+				// comma separated, options are already split on ':'
+				double	w[3];
+				if (3 != sscanf(p_value.c_str(), "%lf,%lf,%lf", &w[0], &w[1], &w[2])
+				|| w[0] < 0.0 || w[1] < 0.0 || w[2] < 0.0 || 0.0 == w[0] + w[1] + w[2])
+					throw std::runtime_error("Invalid weights passed to analyzer (use Y,Cb,Cr ie. 6,1,1)");
+				std::copy(w, w + 3, _weights);
+			}
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual bool high_depth(void) const {
+			return true;
+		}
+
+		virtual int n_series(void) const {
+			return 4;
+		}
+
+		virtual std::string series_name(const int& series) const {
+			static const char	*names[] = { " (Y)", " (Cb)", " (Cr)", " (weighted)" };
+			return names[series];
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			//
+			std::vector<double>	v_res(3*_n_streams);
+			get_plane_psnr_tp(ref, v_ok, streams, v_res);
+			//
+			const double	w_sum = _weights[0] + _weights[1] + _weights[2];
+			for(int i = 0; i < _n_streams; ++i) {
+				const double	*r = &v_res[3*i];
+				for(int p = 0; p < 3; ++p)
+					_ostr << series_var(i, p) << ".push([" << ref_frame << ", " << r[p] << "]);" << std::endl;
+				_ostr << series_var(i, 3) << ".push([" << ref_frame << ", " << (_weights[0]*r[0] + _weights[1]*r[1] + _weights[2]*r[2])/w_sum << "]);" << std::endl;
+			}
+		}
+	};
+
 	class ssim : public s_base {
 	protected:
-		int	_blocksize;
+		int			_blocksize;
+		kernels::ssim_sums_fn	_sums_fn;
+		kernels::ssim_sums16_fn	_sums16_fn;
 
 		void print(const int& ref_frame, const std::vector<double>& v_res) {
 			for(int i = 0; i < _n_streams; ++i)
-				_ostr << "d" << i << ".push([" << ref_frame << ", " << v_res[i] << "]);" << std::endl;
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << v_res[i] << "]);" << std::endl;
 			/*
 			_ostr << ref_frame << ',';
 			for(int i = 0; i < _n_streams; ++i)
@@ -444,28 +1190,393 @@ namespace stats {
 		}
 	public:
 		ssim(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
-		s_base(n_streams, i_width, i_height, ostr), _blocksize(8) {
+		s_base(n_streams, i_width, i_height, ostr), _blocksize(8), _sums_fn(get_ssim_sums(8)), _sums16_fn(get_ssim_sums16(8)) {
 		}
 
 		virtual void set_parameter(const std::string& p_name, const std::string& p_value) {
 			if (p_name == "blocksize") {
 				const int blocksize = atoi(p_value.c_str());
-				if (blocksize > 0) _blocksize = blocksize;
+				if (blocksize > 0) {
+					_blocksize = blocksize;
+					_sums_fn = get_ssim_sums(blocksize);
+					_sums16_fn = get_ssim_sums16(blocksize);
+				}
 			}
 		}
 
-		virtual void process(const int& ref_frame, VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual bool high_depth(void) const {
+			return true;
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
 			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
-			// convert to Y colorspace
-			rgb_2_Y_tp(ref, v_ok, streams);
 			//
 			std::vector<double>	v_res(_n_streams);
-			get_ssim_tp(ref, v_ok, streams, v_res, _i_width, _i_height, _blocksize);
+			get_ssim_tp(ref, v_ok, streams, v_res, _i_width, _i_height, _blocksize, _sums_fn, _sums16_fn);
 			//
 			print(ref_frame, v_res);
 		}
 	};
 
+	// ssim on windows moved by one pixel: the standard 11x11
+	// gaussian one or, faster, a box of "winsize" pixels
+	class sliding_ssim : public s_base {
+		bool		_is_box;
+		unsigned int	_winsize;
+	public:
+		sliding_ssim(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
+		s_base(n_streams, i_width, i_height, ostr), _is_box(false), _winsize(8) {
+		}
+
+		virtual void set_parameter(const std::string& p_name, const std::string& p_value) {
+			if (p_name == "window") {
+				if (p_value != "gauss" && p_value != "box")
+					throw std::runtime_error("Invalid window passed to analyzer (use gauss or box)");
+				_is_box = (p_value == "box");
+			} else if (p_name == "winsize") {
+				const int winsize = atoi(p_value.c_str());
+				if (winsize <= 0 || winsize > 256)
+					throw std::runtime_error("Invalid winsize passed to analyzer (1 to 256)");
+				_winsize = winsize;
+			}
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			//
+			std::vector<double>	v_res(_n_streams);
+			get_sliding_ssim_tp(ref, v_ok, streams, v_res, _is_box, _is_box ? _winsize : 11);
+			//
+			for(int i = 0; i < _n_streams; ++i)
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << v_res[i] << "]);" << std::endl;
+		}
+	};
+
+	// integer ssim on 8x8 windows overlapping by 4 pixels (x264 style),
+	// much faster than sliding_ssim and closer to it than ssim
+	class fast_ssim : public s_base {
+	public:
+		fast_ssim(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
+		s_base(n_streams, i_width, i_height, ostr) {
+		}
+
+		virtual void set_parameter(const std::string&, const std::string&) {
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			//
+			std::vector<double>	v_res(_n_streams);
+			get_fast_ssim_tp(ref, v_ok, streams, v_res);
+			//
+			for(int i = 0; i < _n_streams; ++i)
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << v_res[i] << "]);" << std::endl;
+		}
+	};
+
+	// halved Y planes of the reference and of the streams
+	struct pyramid_entry : public frame_cache::entry {
+		std::vector<std::vector<float> >	levels;
+	};
+
+	// multi-scale ssim (Wang, Simoncelli, Bovik 2003) on the Y plane:
+	// 11x11 gaussian ssim on 5 scales, each one half of the previous.
+	// The pyramids live in the frame_cache, built once per frame;
+	// the reference one is used for all the streams
+	class ms_ssim : public s_base {
+		static const unsigned int	N_SCALES = 5;
+
+		unsigned int					_x[N_SCALES],
+								_y[N_SCALES];
+		// levels 1 ... N_SCALES-1, reference first then the streams
+		std::vector<std::vector<float> >		*_pyr;
+
+		std::vector<float>* levels(const int& stream) {
+			return &(*_pyr)[(stream+1)*(N_SCALES-1)];
+		}
+	public:
+		ms_ssim(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
+		s_base(n_streams, i_width, i_height, ostr), _pyr(0) {
+			_x[0] = i_width;
+			_y[0] = i_height;
+			for(unsigned int s = 1; s < N_SCALES; ++s) {
+				_x[s] = _x[s-1]/2;
+				_y[s] = _y[s-1]/2;
+			}
+			if (_x[N_SCALES-1] < 11 || _y[N_SCALES-1] < 11)
+				throw std::runtime_error("Frames too small for ms_ssim (at least 176x176)");
+		}
+
+		virtual void set_parameter(const std::string&, const std::string&) {
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			// first the pyramids...
+			pyramid_entry	&pyr = _cache->get<pyramid_entry>("y_pyramid");
+			_pyr = &pyr.levels;
+			if (_pyr->empty()) {
+				_pyr->resize((_n_streams+1)*(N_SCALES-1));
+				for(int i = -1; i < _n_streams; ++i)
+					for(unsigned int s = 1; s < N_SCALES; ++s)
+						levels(i)[s-1].resize(_x[s]*_y[s]);
+			}
+			if (!pyr.valid(ref_frame)) {
+				std::vector<shared_ptr<pyramid_job> >	v_p_jobs;
+				mt::TaskGroup				p_tg(stats_tp());
+				v_p_jobs.push_back(new pyramid_job(ref, levels(-1), _x, _y, N_SCALES-1));
+				p_tg.add(v_p_jobs.rbegin()->get());
+				for(int i = 0; i < _n_streams; ++i) {
+					if (!v_ok[i]) continue;
+					v_p_jobs.push_back(new pyramid_job(streams[i], levels(i), _x, _y, N_SCALES-1));
+					p_tg.add(v_p_jobs.rbegin()->get());
+				}
+				p_tg.wait();
+				pyr.set_valid(ref_frame);
+			}
+			// ...then every scale of every stream, in bands of
+			// rows of windows
+			unsigned int	off[N_SCALES+1] = { 0 };
+			for(unsigned int s = 0; s < N_SCALES; ++s)
+				off[s+1] = off[s] + _y[s] - 10;
+			std::vector<double>			v_rows(_n_streams*off[N_SCALES]),
+								v_cs_rows(_n_streams*off[N_SCALES]);
+			std::vector<shared_ptr<mt::Task> >	v_jobs;
+			mt::TaskGroup				tg(stats_tp());
+			for(int i = 0; i < _n_streams; ++i) {
+				if (!v_ok[i]) continue;
+				for(unsigned int s = 0; s < N_SCALES; ++s) {
+					const unsigned int	o_y = _y[s] - 10,
+								n = n_bands(o_y, v_ok, 44);
+					double			*rows = &v_rows[i*off[N_SCALES] + off[s]],
+								*cs_rows = &v_cs_rows[i*off[N_SCALES] + off[s]];
+					for(unsigned int b = 0; b < n; ++b) {
+						const unsigned int	o0 = band_row(o_y, b, n),
+									o1 = band_row(o_y, b+1, n);
+						if (!s) v_jobs.push_back(new ms_ssim_job<unsigned char>(ref.data(0), ref.linesize(0), streams[i].data(0), streams[i].linesize(0), _x[s], o0, o1, rows, cs_rows));
+						else v_jobs.push_back(new ms_ssim_job<float>(&levels(-1)[s-1][0], _x[s], &levels(i)[s-1][0], _x[s], _x[s], o0, o1, rows, cs_rows));
+						tg.add(v_jobs.rbegin()->get());
+					}
+				}
+			}
+			tg.wait();
+			std::vector<double>	v_ssim(_n_streams*N_SCALES),
+						v_cs(_n_streams*N_SCALES);
+			for(int i = 0; i < _n_streams; ++i) {
+				if (!v_ok[i]) continue;
+				for(unsigned int s = 0; s < N_SCALES; ++s) {
+					const double	n_win = (double)(_x[s] - 10)*(_y[s] - 10);
+					v_ssim[i*N_SCALES + s] = rows_mean(&v_rows[i*off[N_SCALES] + off[s]], _y[s] - 10, n_win);
+					v_cs[i*N_SCALES + s] = rows_mean(&v_cs_rows[i*off[N_SCALES] + off[s]], _y[s] - 10, n_win);
+				}
+			}
+			// cs on all the scales but the last, full ssim on that one
+			static const double	weights[N_SCALES] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+			for(int i = 0; i < _n_streams; ++i) {
+				double	res = 0.0;
+				if (v_ok[i]) {
+					res = pow(std::max(0.0, v_ssim[i*N_SCALES + N_SCALES-1]), weights[N_SCALES-1]);
+					for(unsigned int s = 0; s < N_SCALES-1; ++s)
+						res *= pow(std::max(0.0, v_cs[i*N_SCALES + s]), weights[s]);
+				}
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << res << "]);" << std::endl;
+			}
+		}
+	};
+
+	// pixel domain visual information fidelity on the Y plane,
+	// 4 scales with gaussian windows of 17, 9, 5 and 3 samples.
+	// Every scale is split in tiles of TILE x TILE filter positions,
+	// whose float buffers (5 planes of (TILE+16) x TILE) stay in L2,
+	// and the tiles run on the stats thread pool. Tile results are
+	// added in a fixed order, so the score doesn't depend on timing
+	class vif : public s_base {
+		static const unsigned int	N_SCALES = 4,
+						TILE = 64;
+
+		unsigned int				_x[N_SCALES],
+							_y[N_SCALES],
+							_n_tiles;
+		std::vector<float>			_g[N_SCALES];
+		// N_SCALES float planes, reference first then the streams
+		std::vector<std::vector<float> >	_pyr;
+
+		std::vector<float>* levels(const int& stream) {
+			return &_pyr[(stream+1)*N_SCALES];
+		}
+
+		unsigned int o_x(const unsigned int& s) const {
+			return _x[s] - _g[s].size() + 1;
+		}
+
+		unsigned int o_y(const unsigned int& s) const {
+			return _y[s] - _g[s].size() + 1;
+		}
+	public:
+		vif(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
+		s_base(n_streams, i_width, i_height, ostr), _n_tiles(0), _pyr((n_streams+1)*N_SCALES) {
+			for(unsigned int s = 0; s < N_SCALES; ++s) {
+				const unsigned int	k = (1 << (N_SCALES - s)) + 1;
+				gauss_taps(_g[s], k, k/5.0);
+				if (!s) {
+					_x[s] = i_width;
+					_y[s] = i_height;
+				} else {
+					_x[s] = (_x[s-1] - k + 2)/2;
+					_y[s] = (_y[s-1] - k + 2)/2;
+				}
+				if (_x[s] < k || _y[s] < k)
+					throw std::runtime_error("Frames too small for vif (at least 41x41)");
+				_n_tiles += ((o_x(s) + TILE - 1)/TILE)*((o_y(s) + TILE - 1)/TILE);
+			}
+			for(int i = -1; i < n_streams; ++i)
+				for(unsigned int s = 0; s < N_SCALES; ++s)
+					levels(i)[s].resize(_x[s]*_y[s]);
+		}
+
+		virtual void set_parameter(const std::string&, const std::string&) {
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			// first the scales of the reference and of the streams...
+			std::vector<shared_ptr<vif_pyramid_job> >	v_p_jobs;
+			mt::TaskGroup					p_tg(stats_tp());
+			v_p_jobs.push_back(new vif_pyramid_job(ref, levels(-1), _x, _y, _g, N_SCALES));
+			p_tg.add(v_p_jobs.rbegin()->get());
+			for(int i = 0; i < _n_streams; ++i) {
+				if (!v_ok[i]) continue;
+				v_p_jobs.push_back(new vif_pyramid_job(streams[i], levels(i), _x, _y, _g, N_SCALES));
+				p_tg.add(v_p_jobs.rbegin()->get());
+			}
+			p_tg.wait();
+			// ...then all their tiles
+			std::vector<double>			v_num(_n_streams*_n_tiles),
+								v_den(_n_streams*_n_tiles);
+			std::vector<shared_ptr<vif_tile_job> >	v_jobs;
+			mt::TaskGroup				tg(stats_tp());
+			const unsigned int			tile = TILE;
+			for(int i = 0; i < _n_streams; ++i) {
+				if (!v_ok[i]) continue;
+				unsigned int	t_idx = i*_n_tiles;
+				for(unsigned int s = 0; s < N_SCALES; ++s) {
+					const float	*r = &levels(-1)[s][0],
+							*c = &levels(i)[s][0];
+					for(unsigned int oy0 = 0; oy0 < o_y(s); oy0 += TILE)
+						for(unsigned int ox0 = 0; ox0 < o_x(s); ox0 += TILE, ++t_idx) {
+							v_jobs.push_back(new vif_tile_job(r, c, _x[s], ox0, oy0, std::min(tile, o_x(s) - ox0), std::min(tile, o_y(s) - oy0), _g[s], v_num[t_idx], v_den[t_idx]));
+							tg.add(v_jobs.rbegin()->get());
+						}
+				}
+			}
+			tg.wait();
+			for(int i = 0; i < _n_streams; ++i) {
+				double	num = 0.0,
+					den = 0.0;
+				for(unsigned int t = i*_n_tiles; t < (i+1)*_n_tiles; ++t) {
+					num += v_num[t];
+					den += v_den[t];
+				}
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << (v_ok[i] && den > 0.0 ? num/den : 0.0) << "]);" << std::endl;
+			}
+		}
+	};
+
+	// bound to a reference by vif_pyramid_job, needs its storage
+	const unsigned int	vif::N_SCALES;
+
+	// dct and masking of the 8x8 blocks of the reference Y plane
+	struct hvs_entry : public frame_cache::entry {
+		std::vector<float>	dct;
+		std::vector<double>	mask;
+	};
+
+	// psnr-hvs and psnr-hvs-m (Ponomarenko et al.) on the Y plane,
+	// on 8x8 non overlapping blocks. The reference dct and masking
+	// are computed once per frame for all the streams (and shared by
+	// psnr_hvs and psnr_hvsm); blocks are split in bands of BAND
+	// block rows run on the stats thread pool
+	class psnr_hvs : public s_base {
+		static const unsigned int	BAND = 8;
+
+		const bool		_masking;
+		const unsigned int	_bw,
+					_bh;
+	public:
+		psnr_hvs(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr, const bool& masking) :
+		s_base(n_streams, i_width, i_height, ostr), _masking(masking), _bw(i_width/8), _bh(i_height/8) {
+			if (!_bw || !_bh)
+				throw std::runtime_error("Frames too small for psnr_hvs (at least 8x8)");
+		}
+
+		virtual void set_parameter(const std::string&, const std::string&) {
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			return qav::PL_YUV420P;
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			const unsigned int	n_bands = (_bh + BAND - 1)/BAND;
+			// reference first...
+			hvs_entry	&r = _cache->get<hvs_entry>("y_dct8x8");
+			if (!r.valid(ref_frame)) {
+				r.dct.resize(64*_bw*_bh);
+				r.mask.resize(_bw*_bh);
+				std::vector<shared_ptr<hvs_ref_job> >	v_r_jobs;
+				mt::TaskGroup				r_tg(stats_tp());
+				for(unsigned int b = 0; b < n_bands; ++b) {
+					v_r_jobs.push_back(new hvs_ref_job(ref, _bw, b*BAND, std::min(_bh, (b+1)*BAND), &r.dct[0], &r.mask[0]));
+					r_tg.add(v_r_jobs.rbegin()->get());
+				}
+				r_tg.wait();
+				r.set_valid(ref_frame);
+			}
+			// ...then all the streams
+			std::vector<double>			v_hvs(_n_streams*n_bands),
+								v_hvsm(_n_streams*n_bands);
+			std::vector<shared_ptr<hvs_job> >	v_jobs;
+			mt::TaskGroup				tg(stats_tp());
+			for(int i = 0; i < _n_streams; ++i) {
+				if (!v_ok[i]) continue;
+				for(unsigned int b = 0; b < n_bands; ++b) {
+					v_jobs.push_back(new hvs_job(&r.dct[0], &r.mask[0], streams[i], _bw, b*BAND, std::min(_bh, (b+1)*BAND), v_hvs[i*n_bands + b], v_hvsm[i*n_bands + b]));
+					tg.add(v_jobs.rbegin()->get());
+				}
+			}
+			tg.wait();
+			for(int i = 0; i < _n_streams; ++i) {
+				double	s = 0.0;
+				for(unsigned int b = 0; b < n_bands; ++b)
+					s += _masking ? v_hvsm[i*n_bands + b] : v_hvs[i*n_bands + b];
+				s /= 64.0*_bw*_bh;
+				if (0.0 == s) s = 1e-10;
+				_ostr << series_var(i) << ".push([" << ref_frame << ", " << (v_ok[i] ? 10.0*log10(65025.0/s) : 0.0) << "]);" << std::endl;
+			}
+		}
+	};
+
 	class avg_ssim : public ssim {
 		int			_fpa,
 					_accum_f,
@@ -498,15 +1609,13 @@ namespace stats {
 			}
 		}
 
-		virtual void process(const int& ref_frame, VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) {
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
 			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
 			// set last frame
 			_last_frame = ref_frame;
-			// convert to Y colorspace
-			rgb_2_Y_tp(ref, v_ok, streams);
 			//
 			std::vector<double>	v_res(_n_streams);
-			get_ssim_tp(ref, v_ok, streams, v_res, _i_width, _i_height, _blocksize);
+			get_ssim_tp(ref, v_ok, streams, v_res, _i_width, _i_height, _blocksize, _sums_fn, _sums16_fn);
 			// accumulate for each
 			for(int i = 0; i < _n_streams; ++i) {
 				if (v_ok[i]) {
@@ -529,13 +1638,150 @@ namespace stats {
 			}
 		}
 	};
+
+	// frames converted to another layout (RGB24, or 8 bits YUV420P
+	// from high depth ones), reference first then the streams. sws
+	// contexts can't be shared among threads, each frame has its
+	// own scaler
+	struct conv_entry : public frame_cache::entry {
+		std::vector<shared_ptr<qav::scaler> >	v_sc;
+		qav::frame				ref;
+		V_FRAME					streams;
+	};
+
+	class conv_job : public mt::Task {
+		qav::scaler		&_sc;
+		const qav::frame	&_src;
+		qav::frame		&_dst;
+	public:
+		conv_job(qav::scaler& sc, const qav::frame& src, qav::frame& dst) :
+		_sc(sc), _src(src), _dst(dst) {
+		}
+
+		virtual void run(void) {
+			const unsigned char	*data[3] = { _src.data(0), _src.data(1), _src.data(2) };
+			const int		linesize[3] = { _src.linesize(0), _src.linesize(1), _src.linesize(2) };
+			_sc.scale(data, linesize, _dst);
+			_dst.set_pts(_src.pts());
+		}
+	};
+
+	// several analyzers (ie. "psnr,ssim,ms_ssim") on the same frames,
+	// sharing one frame_cache; their series are numbered one after
+	// the other. Frames are decoded in YUV420P as soon as one of the
+	// analyzers wants them so, and with high depth samples as soon as
+	// one of those takes them; the others then get a conversion made
+	// once per frame (the same libswscale one the decoder would have
+	// done when there's no scaling)
+	class multi : public s_base {
+		std::vector<shared_ptr<s_base> >	_v_an;
+		std::vector<std::string>		_v_id;
+		frame_cache				_shared;
+
+		const conv_entry& converted(const qav::pix_layout& layout, const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			conv_entry	&cv = _shared.get<conv_entry>(qav::layout_name(layout));
+			if (cv.v_sc.empty()) {
+				for(int i = -1; i < _n_streams; ++i)
+					cv.v_sc.push_back(new qav::scaler(_i_width, _i_height, qav::scaler::fmt(ref.layout()), _i_width, _i_height, layout));
+				cv.streams.resize(_n_streams);
+			}
+			if (!cv.valid(ref_frame)) {
+				std::vector<shared_ptr<conv_job> >	v_jobs;
+				mt::TaskGroup				tg(stats_tp());
+				v_jobs.push_back(new conv_job(*cv.v_sc[0].get(), ref, cv.ref));
+				tg.add(v_jobs.rbegin()->get());
+				for(int i = 0; i < _n_streams; ++i) {
+					if (!v_ok[i]) continue;
+					v_jobs.push_back(new conv_job(*cv.v_sc[i+1].get(), streams[i], cv.streams[i]));
+					tg.add(v_jobs.rbegin()->get());
+				}
+				tg.wait();
+				cv.set_valid(ref_frame);
+			}
+			return cv;
+		}
+	public:
+		multi(const std::string& ids, const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) :
+		s_base(n_streams, i_width, i_height, ostr) {
+			std::string::size_type	p = 0;
+			do {
+				const std::string::size_type	e = ids.find(',', p);
+				_v_id.push_back(ids.substr(p, (e == std::string::npos) ? e : e - p));
+				_v_an.push_back(get_analyzer(_v_id.rbegin()->c_str(), n_streams, i_width, i_height, ostr));
+				p = (e == std::string::npos) ? e : e + 1;
+			} while(p != std::string::npos);
+			int	first = 0;
+			for(size_t i = 0; i < _v_an.size(); ++i) {
+				_v_an[i]->share(&_shared, first, n_series());
+				first += _v_an[i]->n_series();
+			}
+		}
+
+		// options go to all the analyzers, each one takes its own
+		virtual void set_parameter(const std::string& p_name, const std::string& p_value) {
+			for(size_t i = 0; i < _v_an.size(); ++i)
+				_v_an[i]->set_parameter(p_name, p_value);
+		}
+
+		virtual qav::pix_layout get_layout(void) const {
+			for(size_t i = 0; i < _v_an.size(); ++i)
+				if (qav::PL_YUV420P == _v_an[i]->get_layout()) return qav::PL_YUV420P;
+			return qav::PL_RGB24;
+		}
+
+		// as soon as one of them takes it, the others get 8 bits frames
+		virtual bool high_depth(void) const {
+			for(size_t i = 0; i < _v_an.size(); ++i)
+				if (_v_an[i]->high_depth()) return true;
+			return false;
+		}
+
+		virtual int n_series(void) const {
+			int	n = 0;
+			for(size_t i = 0; i < _v_an.size(); ++i)
+				n += _v_an[i]->n_series();
+			return n;
+		}
+
+		virtual std::string series_name(const int& series) const {
+			int	s = series;
+			size_t	i = 0;
+			while(s >= _v_an[i]->n_series())
+				s -= _v_an[i++]->n_series();
+			return " " + _v_id[i] + _v_an[i]->series_name(s);
+		}
+
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) {
+			if (v_ok.size() != streams.size() || v_ok.size() != (unsigned int)_n_streams) throw std::runtime_error("Invalid data size passed to analyzer");
+			//
+			for(size_t i = 0; i < _v_an.size(); ++i) {
+				qav::pix_layout	layout = _v_an[i]->get_layout();
+				if (qav::PL_YUV420P == layout && _v_an[i]->high_depth())
+					layout = ref.layout();
+				if (layout == ref.layout()) {
+					_v_an[i]->process(ref_frame, ref, v_ok, streams);
+				} else {
+					const conv_entry	&cv = converted(layout, ref_frame, ref, v_ok, streams);
+					_v_an[i]->process(ref_frame, cv.ref, v_ok, cv.streams);
+				}
+			}
+		}
+	};
 }
 
 stats::s_base* stats::get_analyzer(const char* id, const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) {
 	const std::string	s_id(id);
-	if (s_id == "psnr") return new psnr(n_streams, i_width, i_height, ostr);
+	if (s_id.find(',') != std::string::npos) return new multi(s_id, n_streams, i_width, i_height, ostr);
+	else if (s_id == "psnr") return new psnr(n_streams, i_width, i_height, ostr);
 	else if (s_id == "avg_psnr") return new avg_psnr(n_streams, i_width, i_height, ostr);
+	else if (s_id == "plane_psnr") return new plane_psnr(n_streams, i_width, i_height, ostr);
 	else if (s_id == "ssim") return new ssim(n_streams, i_width, i_height, ostr);
 	else if (s_id == "avg_ssim") return new avg_ssim(n_streams, i_width, i_height, ostr);
+	else if (s_id == "sliding_ssim") return new sliding_ssim(n_streams, i_width, i_height, ostr);
+	else if (s_id == "fast_ssim") return new fast_ssim(n_streams, i_width, i_height, ostr);
+	else if (s_id == "ms_ssim") return new ms_ssim(n_streams, i_width, i_height, ostr);
+	else if (s_id == "vif") return new vif(n_streams, i_width, i_height, ostr);
+	else if (s_id == "psnr_hvs") return new psnr_hvs(n_streams, i_width, i_height, ostr, false);
+	else if (s_id == "psnr_hvsm") return new psnr_hvs(n_streams, i_width, i_height, ostr, true);
 	throw std::runtime_error("Invalid analyzer id");
 }
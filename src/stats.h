@@ -21,31 +21,116 @@
 #define _STATS_H_
 
 #include <vector>
+#include <map>
 #include <ostream>
+#include <sstream>
 #include <string>
+#include "frame.h"
+#include "shared_ptr.h"
 
 namespace stats {
-	typedef std::vector<unsigned char>	VUCHAR;
+	typedef std::vector<qav::frame>	V_FRAME;
+
+	// Planes derived from the frames being analyzed (ie. the Y
+	// pyramid of the reference): the first analyzer which needs
+	// them computes them, the others running on the same frames
+	// just read them. Entries and their buffers are kept across
+	// frames, each one records the frame it has been computed for
+	class frame_cache {
+	public:
+		class entry {
+			int	_frame;
+		public:
+			entry() : _frame(-1) {
+			}
+
+			bool valid(const int& ref_frame) const {
+				return _frame == ref_frame;
+			}
+
+			void set_valid(const int& ref_frame) {
+				_frame = ref_frame;
+			}
+
+			virtual ~entry() {
+			}
+		};
+	private:
+		typedef std::map<std::string, shared_ptr<entry> >	M_ENTRY;
+		M_ENTRY	_entries;
+	public:
+		// entry of the given key, created (empty) on first use
+		template<typename T>
+		T& get(const std::string& key) {
+			M_ENTRY::iterator	it = _entries.find(key);
+			if (it == _entries.end())
+				it = _entries.insert(M_ENTRY::value_type(key, shared_ptr<entry>(new T))).first;
+			return dynamic_cast<T&>(*it->second.get());
+		}
+	};
 
 	class s_base {
+		frame_cache	_own_cache;
+		int		_first_series,
+				_all_series;
 	protected:
 		const int	_n_streams,
 				_i_width,
 				_i_height;
 		std::ostream	&_ostr;
+		frame_cache	*_cache;
 	public:
 		s_base(const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr) : 
-		_n_streams(n_streams), _i_width(i_width), _i_height(i_height), _ostr(ostr) {
+		_first_series(0), _all_series(0), _n_streams(n_streams), _i_width(i_width), _i_height(i_height), _ostr(ostr), _cache(&_own_cache) {
 		}
 
 		virtual void set_parameter(const std::string& p_name, const std::string& p_value) = 0;
 
-		virtual void process(const int& ref_frame, VUCHAR& ref, const std::vector<bool>& v_ok, std::vector<VUCHAR>& streams) = 0;
+		// the pixel layout the frames have to be passed in
+		virtual qav::pix_layout get_layout(void) const = 0;
+
+		// whether PL_YUV420P frames of high bit depth sources can
+		// be passed as they are (PL_YUV420P10 or PL_YUV420P12)
+		virtual bool high_depth(void) const {
+			return false;
+		}
+
+		// values given for each stream and frame, each one is
+		// plotted as its own series (ie. one per plane)
+		virtual int n_series(void) const {
+			return 1;
+		}
+
+		// label of a series, appended to the stream name
+		virtual std::string series_name(const int&) const {
+			return "";
+		}
+
+		// javascript variable holding a series of a stream
+		std::string series_var(const int& stream, const int& series = 0) const {
+			std::ostringstream	oss;
+			oss << 'd' << stream;
+			if ((_all_series ? _all_series : n_series()) > 1) oss << '_' << _first_series + series;
+			return oss.str();
+		}
+
+		// when run along with other analyzers: the frame_cache they
+		// share and where our series start among all of theirs
+		void share(frame_cache *cache, const int& first_series, const int& all_series) {
+			_cache = cache;
+			_first_series = first_series;
+			_all_series = all_series;
+		}
+
+		// frames are shared with the other analyzers, never modified
+		virtual void process(const int& ref_frame, const qav::frame& ref, const std::vector<bool>& v_ok, const V_FRAME& streams) = 0;
 
 		virtual ~s_base() {
 		}
 	};
 
+	// id can be a comma separated list (ie. "psnr,ssim"), then
+	// all the analyzers run on the same frames
 	extern s_base* get_analyzer(const char* id, const int& n_streams, const int& i_width, const int& i_height, std::ostream& ostr);
 }
 